@@ -4,6 +4,32 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <setjmp.h>
+#ifdef _WIN32
+#include <winsock2.h>
+typedef SOCKET socket_t;
+#define close_socket closesocket
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+typedef int socket_t;
+#define close_socket close
+#endif
+#if defined(HOST_PROFILE) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+#if defined(HOST_PROFILE) && defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#include "simulator.h"
 
 // --- Configuration (Package 1 Specific) ---
 #define MEMORY_SIZE 2048
@@ -11,6 +37,10 @@
 #define INSTRUCTION_MEM_END 1023
 #define DATA_MEM_START 1024
 
+// --- Halt Reasons (values of halt_simulation) ---
+#define HALT_DRAINED     1 // PC past the program and pipeline empty
+#define HALT_CYCLE_LIMIT 2 // Safety break / --max-cycles reached
+
 // --- Opcodes (Package 1) ---
 #define OPCODE_ADD  0
 #define OPCODE_SUB  1
@@ -24,8 +54,29 @@
 #define OPCODE_SRL  9
 #define OPCODE_LW   10
 #define OPCODE_SW   11
+#define OPCODE_VMEM 12 // VLD/VST (bit 17 set = store)
+#define OPCODE_VALU 13 // VADD/VSUB (bit 0 set = subtract)
+#define OPCODE_VSUM 14 // Reduction of a vector register into a scalar register
 #define OPCODE_NOP  15
 
+// --- Vector Extension ---
+// Vector instructions operate on vector_length contiguous words; the length is
+// a pipeline setting (vlen, --vlen) bounded by MAX_VECTOR_LENGTH.
+#define NUM_VECTOR_REGISTERS 8
+#define MAX_VECTOR_LENGTH    16
+#define VMEM_STORE_BIT (1u << 17)
+#define VALU_SUB_BIT   1u
+
+// --- Macro-op fusion ---
+// Pairs IF fetches as one micro-op when --pipeline fusion=on (see fusion_kind).
+// The debugger and the gdb stub treat a fused pair as one instruction: a
+// breakpoint on either half stops at the pair, and a step covers both.
+#define FUSION_NONE      0
+#define FUSION_ADDI_BNE  1 // ADDI Rx Ry k; BNE reading Rx (loop counter)
+#define FUSION_ADDI_LW   2 // ADDI Rx Ry k; LW with base Rx (address computation)
+#define FUSION_ADDI_SW   3 // ADDI Rx Ry k; SW with base Rx
+#define NUM_FUSION_KINDS 4
+
 // --- Structures ---
 typedef struct {
     uint32_t opcode;     // 4 bits
@@ -38,12 +89,21 @@ typedef struct {
     int32_t val_R3_source;
     int32_t alu_result;
     int32_t mem_read_val;
-    char type; // 'R', 'I', 'J', 'N' (NOP), 'U' (Unknown/Undecoded)
+    uint32_t V1_idx, V2_idx, V3_idx; // Vector register indices
+    bool vector_funct;               // VMEM: store, VALU: subtract
+    int32_t vector_data[MAX_VECTOR_LENGTH]; // VLD/VALU result on its way to WB
+    char type; // 'R', 'I', 'J', 'V', 'N' (NOP), 'U' (Unknown/Undecoded)
     int original_pc;
+    uint32_t fused_R1_idx;    // Destination of a fused ADDI, 0 if not fused
+    int32_t  fused_source;    // Its R2 value
+    int32_t  fused_immediate;
+    int32_t  fused_result;    // Written back before this instruction's own result
 } DecodedInstruction;
 
 typedef struct {
     uint32_t raw_instruction;
+    uint32_t fused_raw; // ADDI fused ahead of raw_instruction (fusion != FUSION_NONE)
+    uint8_t  fusion;    // FUSION_* pair this latch holds
     DecodedInstruction decoded_info;
     uint8_t cycles_spent_in_stage;
     int instruction_pc_at_fetch;
@@ -51,26 +111,354 @@ typedef struct {
 } PipelineRegister;
 
 // --- Global State ---
-uint32_t memory[MEMORY_SIZE];
-int32_t  registers[NUM_REGISTERS];
-int32_t  PC = 0;
-int      current_cycle = 0;
-
-PipelineRegister active_in_IF_stage  = {.valid = false};
-PipelineRegister active_in_ID_stage  = {.valid = false};
-PipelineRegister active_in_EX_stage  = {.valid = false};
-PipelineRegister active_in_MEM_stage = {.valid = false};
-PipelineRegister active_in_WB_stage  = {.valid = false};
-
-int halt_simulation = 0;
-int instructions_loaded_count = 0;
-
-bool can_IF_operate_this_cycle = false;
-bool can_MEM_operate_this_cycle = false;
-bool branch_taken_in_EX_cycle2 = false;
-uint32_t branch_target_pc = 0;
-bool stall_IF_for_mem_after_branch = false;
-bool hazard_detected = false; // New flag for load-use hazard stalling
+// Machine state is thread-local so independent simulations (e.g. fuzzing
+// workers) can run on separate host threads without sharing a pipeline.
+_Thread_local uint32_t memory[MEMORY_SIZE];
+_Thread_local int32_t  registers[NUM_REGISTERS];
+_Thread_local int32_t  vector_registers[NUM_VECTOR_REGISTERS][MAX_VECTOR_LENGTH];
+_Thread_local int32_t  PC = 0;
+_Thread_local int      current_cycle = 0;
+
+_Thread_local PipelineRegister active_in_IF_stage  = {.valid = false};
+_Thread_local PipelineRegister active_in_ID_stage  = {.valid = false};
+_Thread_local PipelineRegister active_in_EX_stage  = {.valid = false};
+_Thread_local PipelineRegister active_in_MEM_stage = {.valid = false};
+_Thread_local PipelineRegister active_in_WB_stage  = {.valid = false};
+
+_Thread_local int halt_simulation = 0;
+_Thread_local int instructions_loaded_count = 0;
+_Thread_local int cycle_limit = 0; // 0 = default safety break (instructions + 30)
+_Thread_local int empty_pipeline_cycles = 0;
+_Thread_local long instructions_retired = 0;
+_Thread_local long idle_cycles_skipped = 0; // Cycles fast-forwarded by skip_idle_cycles
+_Thread_local long fused_pairs_retired[NUM_FUSION_KINDS];
+_Thread_local int fetched_pc_this_cycle = -1; // PC fetched by IF this cycle, -1 if none
+_Thread_local bool fetched_pair_this_cycle = false; // That fetch was a fused pair (PC and PC + 1)
+
+_Thread_local bool can_IF_operate_this_cycle = false;
+_Thread_local bool can_MEM_operate_this_cycle = false;
+_Thread_local bool branch_taken_in_EX_cycle2 = false;
+_Thread_local uint32_t branch_target_pc = 0;
+_Thread_local bool stall_IF_for_mem_after_branch = false;
+_Thread_local bool hazard_detected = false; // New flag for load-use hazard stalling
+_Thread_local int load_use_stall_pc = -1; // Instruction held in ID by a load-use stall (profiler)
+_Thread_local int flush_branch_pc = -1;   // Taken branch whose refill is in progress (profiler)
+
+// --- Pipeline Configuration ---
+// Microarchitecture knobs explored by --sweep. The defaults reproduce the
+// original Package 1 pipeline cycle for cycle.
+#define BRANCH_FLUSH 0 // Keep fetching past a branch; flush ID/IF when taken in EX
+#define BRANCH_STALL 1 // Stop fetching until the branch in ID/EX resolves
+#define MAX_STAGE_LATENCY 8
+#define NUM_OPCODES 16
+
+// Functional units of EX. A blocking unit holds the EX latch for the whole
+// latency of its instruction; a pipelined one takes a new instruction every
+// cycle and finishes the latency in ex_in_flight. Branches always resolve in
+// the latch.
+#define EX_UNIT_ALU    0 // ADD SUB SLL SRL ADDI ANDI ORI BNE J NOP
+#define EX_UNIT_MUL    1 // MULI
+#define EX_UNIT_AGU    2 // LW SW VLD VST address generation
+#define EX_UNIT_VECTOR 3 // VADD VSUB VSUM
+#define NUM_EX_UNITS   4
+
+typedef struct {
+    bool split_memory_ports; // IF and MEM each have a port (every cycle) vs one shared odd/even port
+    int  id_latency;         // Cycles an instruction spends in ID
+    int  ex_latency;         // Cycles an instruction spends in EX, unless overridden below
+    bool forwarding;         // EX/MEM/WB -> ID bypass; off = wait for write-back
+    int  branch_policy;      // BRANCH_FLUSH or BRANCH_STALL
+    int  mem_latency;        // MEM cycles (with the port) a LW/SW/VLD/VST needs
+    bool fusion;             // Fetch ADDI+BNE/LW/SW pairs as one micro-op
+    int  store_buffer_depth; // SWs MEM can park until the port is free, 0 = stores write through
+    uint8_t opcode_ex_latency[NUM_OPCODES]; // Per-opcode EX latency, 0 = ex_latency
+    bool unit_pipelined[NUM_EX_UNITS];
+    int  vector_length;      // Elements per vector instruction, 1..MAX_VECTOR_LENGTH
+} PipelineConfig;
+
+#define DEFAULT_PIPELINE_CONFIG { .split_memory_ports = false, .id_latency = 2, .ex_latency = 2, \
+                                  .forwarding = true, .branch_policy = BRANCH_FLUSH, .mem_latency = 1, \
+                                  .vector_length = 8 }
+_Thread_local PipelineConfig pipeline_config = DEFAULT_PIPELINE_CONFIG;
+PipelineConfig configured_pipeline = DEFAULT_PIPELINE_CONFIG; // From --pipeline/--latency; copied by worker threads
+
+// Instructions that left the EX latch for a pipelined unit and are still
+// finishing their latency, oldest first; they enter MEM in program order.
+#define EX_IN_FLIGHT_CAPACITY MAX_STAGE_LATENCY
+_Thread_local PipelineRegister ex_in_flight[EX_IN_FLIGHT_CAPACITY];
+_Thread_local int ex_in_flight_count = 0;
+
+// Store buffer of the MEM stage (store_buffer_depth > 0), oldest first. A SW
+// to data memory leaves MEM as soon as it has an entry, with or without the
+// port; entries are written to memory in port cycles nobody else uses.
+#define MAX_STORE_BUFFER_DEPTH 16
+typedef struct {
+    int32_t  address;
+    uint32_t value;
+    int      cycles; // Port cycles spent writing (head only)
+} StoreBufferEntry;
+
+typedef struct {
+    long buffered;     // SWs that left MEM through the buffer
+    long forwarded;    // LWs served from the buffer
+    long drained;      // Entries written to memory in idle port cycles
+    long full_cycles;  // Cycles a SW waited in MEM for a free entry
+    long fence_cycles; // Cycles a VLD/VST waited in MEM for the buffer to drain
+    long port_yielded; // Cycles a buffered store waited while IF or a LW used the port
+} StoreBufferStats;
+
+_Thread_local StoreBufferEntry store_buffer[MAX_STORE_BUFFER_DEPTH];
+_Thread_local int  store_buffer_count = 0;
+_Thread_local StoreBufferStats store_buffer_stats;
+_Thread_local bool mem_port_used = false;     // MEM accessed memory through the port this cycle
+_Thread_local bool mem_port_bypassed = false; // MEM finished through the store buffer this cycle
+
+int ex_unit_of(uint32_t opcode) {
+    switch (opcode) {
+        case OPCODE_MULI: return EX_UNIT_MUL;
+        case OPCODE_LW: case OPCODE_SW: case OPCODE_VMEM: return EX_UNIT_AGU;
+        case OPCODE_VALU: case OPCODE_VSUM: return EX_UNIT_VECTOR;
+        default: return EX_UNIT_ALU;
+    }
+}
+
+int ex_latency_of(uint32_t opcode) {
+    int latency = pipeline_config.opcode_ex_latency[opcode & 0xF];
+    return latency ? latency : pipeline_config.ex_latency;
+}
+
+// Cycles the instruction holds the EX latch before it can move on.
+int ex_occupancy_of(uint32_t opcode) {
+    if (opcode == OPCODE_BNE || opcode == OPCODE_J) return ex_latency_of(opcode);
+    return pipeline_config.unit_pipelined[ex_unit_of(opcode)] ? 1 : ex_latency_of(opcode);
+}
+
+// cycles_spent_in_stage counts EX cycles in the latch and in ex_in_flight.
+bool ex_result_ready(const PipelineRegister* stage) {
+    return stage->cycles_spent_in_stage >= ex_latency_of(stage->decoded_info.opcode);
+}
+
+int mem_latency_of(uint32_t opcode) {
+    return (opcode == OPCODE_LW || opcode == OPCODE_SW || opcode == OPCODE_VMEM) ? pipeline_config.mem_latency : 1;
+}
+
+bool mem_access_done(const PipelineRegister* stage) {
+    return stage->decoded_info.type == 'N' ||
+           stage->cycles_spent_in_stage >= mem_latency_of(stage->decoded_info.opcode);
+}
+
+// --- Timing rules ---
+// The decisions of the timing model, taking plain facts about the stages.
+// simulate_clock_cycle and replay_timing (and the idle skip and gdb stub)
+// both go through these, so a change to the rules reaches every model.
+
+// With a shared port IF has memory in odd cycles and MEM in even ones.
+bool IF_port_cycle(long cycle) {
+    return pipeline_config.split_memory_ports || cycle % 2 != 0;
+}
+
+bool MEM_port_cycle(long cycle) {
+    return pipeline_config.split_memory_ports || cycle % 2 == 0;
+}
+
+// A branch taken in an IF cycle of a shared port re-fetches through the
+// port and takes the next IF cycle as well.
+bool taken_branch_stalls_IF(long cycle) {
+    return !pipeline_config.split_memory_ports && cycle % 2 != 0;
+}
+
+// Whether the newest producer of an operand keeps ID waiting (operand_pending):
+// in EX until it has computed its result, a LW in MEM until its access is
+// done, and any producer until write-back when forwarding is off.
+bool EX_producer_pending(bool is_load, int cycles, int ex_latency) {
+    return !pipeline_config.forwarding || is_load || cycles < ex_latency;
+}
+
+bool MEM_producer_pending(bool is_load, int cycles, int mem_latency) {
+    return !pipeline_config.forwarding || (is_load && cycles < mem_latency);
+}
+
+// Registers decode has to wait for, written to sources; returns how many. A
+// fused pair (addi_r1 != 0) waits for the ADDI's source and the second
+// instruction's other sources; its reads of addi_r1 come from inside the
+// micro-op.
+int decode_source_registers(uint8_t opcode, uint32_t r1, uint32_t r2, uint32_t r3,
+                            uint32_t addi_r1, uint32_t addi_r2, uint32_t sources[3]) {
+    int n = 0;
+    if (addi_r1 != 0) {
+        sources[n++] = addi_r2;
+        if (opcode != OPCODE_LW && r1 != addi_r1) sources[n++] = r1;
+        if (r2 != addi_r1) sources[n++] = r2;
+        return n;
+    }
+    switch (opcode) {
+        case OPCODE_ADD: case OPCODE_SUB:
+            sources[n++] = r2;
+            sources[n++] = r3;
+            break;
+        case OPCODE_BNE: case OPCODE_SW:
+            sources[n++] = r1;
+            sources[n++] = r2;
+            break;
+        case OPCODE_SLL: case OPCODE_SRL: case OPCODE_MULI: case OPCODE_ADDI:
+        case OPCODE_ANDI: case OPCODE_ORI: case OPCODE_LW: case OPCODE_VMEM:
+            sources[n++] = r2;
+            break;
+    }
+    return n;
+}
+
+// A LW in EX writing lw_reg stalls an instruction naming it in any field
+// (the shift amount of SLL/SRL sits where R3 would be).
+bool load_use_conflict(uint32_t lw_reg, uint8_t opcode, uint32_t r1, uint32_t r2, uint32_t r3) {
+    return lw_reg != 0 && (lw_reg == r1 || lw_reg == r2 ||
+                           (opcode != OPCODE_SLL && opcode != OPCODE_SRL && lw_reg == r3));
+}
+
+bool is_branch_opcode(uint32_t opcode) {
+    return opcode == OPCODE_BNE || opcode == OPCODE_J;
+}
+
+// BRANCH_STALL holds fetch while a BNE/J in ID, or one in EX that has not
+// resolved, could still redirect it.
+bool branch_holds_fetch(bool ID_branch, bool EX_unresolved_branch) {
+    return pipeline_config.branch_policy == BRANCH_STALL && (ID_branch || EX_unresolved_branch);
+}
+
+// What IF does in a cycle, in order of precedence.
+#define FETCH_GO         0
+#define FETCH_HAZARD     1 // ID stalled on a hazard; the IF latch keeps its instruction
+#define FETCH_ID_BUSY    2 // ID cannot take a new instruction
+#define FETCH_BRANCH     3 // branch_holds_fetch
+#define FETCH_SUPPRESSED 4 // A branch was taken in EX this cycle
+#define FETCH_NO_PORT    5 // The port belongs to MEM (or IF is stalled after a branch)
+
+int fetch_decision(bool can_IF, bool suppressed, bool hazard, bool ID_free, bool branch_holds) {
+    if (hazard) return FETCH_HAZARD;
+    if (can_IF && !suppressed && !ID_free) return FETCH_ID_BUSY;
+    if (can_IF && !suppressed && branch_holds) return FETCH_BRANCH;
+    if (can_IF && !suppressed) return FETCH_GO;
+    return suppressed ? FETCH_SUPPRESSED : FETCH_NO_PORT;
+}
+
+// Which latches empty at the end of a cycle. An instruction only moves on
+// once the stage ahead of it is free, so a stage that has not finished (or
+// cannot get the memory port) holds everything behind it. Instructions reach
+// MEM in order: the oldest in flight first, and the EX latch goes straight
+// to MEM only when nothing is in flight.
+typedef struct {
+    bool MEM_valid, MEM_done;          // MEM_done: access complete and allowed to leave this cycle
+    int  in_flight_count;
+    bool in_flight_ready;              // Oldest in-flight result computed
+    bool EX_valid, EX_done, EX_ready;  // EX_done: occupancy served; EX_ready: result computed
+    bool ID_valid, ID_ready;           // ID_ready: decoded with no hazard
+} StageStatus;
+
+typedef struct {
+    bool MEM_leaves, MEM_free, in_flight_leaves, EX_to_MEM, EX_to_in_flight, EX_free, ID_leaves, ID_free;
+} LatchMoves;
+
+LatchMoves plan_latch_moves(const StageStatus* s) {
+    LatchMoves m;
+    m.MEM_leaves = s->MEM_valid && s->MEM_done;
+    m.MEM_free = !s->MEM_valid || m.MEM_leaves;
+    m.in_flight_leaves = s->in_flight_count > 0 && s->in_flight_ready && m.MEM_free;
+    bool EX_done = s->EX_valid && s->EX_done;
+    m.EX_to_MEM = EX_done && s->in_flight_count == 0 && s->EX_ready && m.MEM_free;
+    m.EX_to_in_flight = EX_done && !m.EX_to_MEM && s->in_flight_count - m.in_flight_leaves < EX_IN_FLIGHT_CAPACITY;
+    m.EX_free = !s->EX_valid || m.EX_to_MEM || m.EX_to_in_flight;
+    m.ID_leaves = s->ID_valid && s->ID_ready && m.EX_free;
+    m.ID_free = !s->ID_valid || m.ID_leaves;
+    return m;
+}
+
+// The store buffer writes back in a port cycle nobody else uses: not one
+// where MEM went through the port, nor, on a shared port, one IF fetched in.
+bool store_buffer_may_drain(bool MEM_port_used, bool IF_fetched, bool can_MEM) {
+    if (MEM_port_used) return false;
+    return pipeline_config.split_memory_ports ? can_MEM : !IF_fetched;
+}
+
+// Cycles the pipeline has to stay empty (PC past the program) before halting.
+#define HALT_EMPTY_CYCLES 3
+
+// --- Dirty Page Tracking ---
+// Stores mark the page they hit so the final-state diff only has to look at
+// pages the program actually wrote.
+#define DIRTY_PAGE_WORDS 64
+#define NUM_DIRTY_PAGES  (MEMORY_SIZE / DIRTY_PAGE_WORDS)
+_Thread_local bool page_dirty[NUM_DIRTY_PAGES];
+_Thread_local int  dirty_page_list[NUM_DIRTY_PAGES];
+_Thread_local int  dirty_page_count = 0;
+
+void mark_page_dirty(int address) {
+    int page = address / DIRTY_PAGE_WORDS;
+    if (!page_dirty[page]) {
+        page_dirty[page] = true;
+        dirty_page_list[dirty_page_count++] = page;
+    }
+}
+
+void clear_dirty_pages() {
+    for (int p = 0; p < dirty_page_count; p++) page_dirty[dirty_page_list[p]] = false;
+    dirty_page_count = 0;
+}
+
+// --- Tracing ---
+// Per-cycle stage output; switched off for batch runs (fuzzing) where the
+// printf cost dominates.
+_Thread_local bool trace_enabled = true;
+
+// --- Host Self-Profiling ---
+// Built with -DHOST_PROFILE (the "Profile" target), the simulator times its
+// own stages with the TSC (clock_gettime nanoseconds off x86) and reports host
+// ticks per simulated cycle at exit, see print_host_profile. Timers are
+// exclusive: a section nested in another (a forwarding lookup in ID, a trace
+// printf anywhere) is charged only to itself. Without the flag the macros
+// reduce to the bare statement.
+#define HOST_IF      0
+#define HOST_ID      1
+#define HOST_EX      2
+#define HOST_MEM     3
+#define HOST_WB      4
+#define HOST_FORWARD 5 // Hazard checks and operand forwarding in ID
+#define HOST_LATCH   6 // Latch copies at the end of the cycle
+#define HOST_TRACE   7 // Trace printf
+#define HOST_CONTROL 8 // Rest of simulate_clock_cycle
+#define NUM_HOST_SECTIONS 9
+#ifdef HOST_PROFILE
+_Thread_local uint64_t host_ticks[NUM_HOST_SECTIONS + 1]; // Last entry: time outside simulate_clock_cycle (unused)
+_Thread_local int  host_section = NUM_HOST_SECTIONS;
+_Thread_local long host_cycles_stepped = 0;
+
+static inline uint64_t host_clock() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#endif
+}
+
+#define HOST_TIMER_START(section) \
+    int host_parent_##section = host_section; uint64_t host_start_##section = host_clock(); host_section = (section)
+#define HOST_TIMER_STOP(section) do { \
+        uint64_t host_elapsed = host_clock() - host_start_##section; \
+        host_ticks[section] += host_elapsed; \
+        host_ticks[host_parent_##section] -= host_elapsed; \
+        host_section = host_parent_##section; \
+    } while (0)
+#define HOST_TIMED(section, ...) do { HOST_TIMER_START(section); __VA_ARGS__; HOST_TIMER_STOP(section); } while (0)
+#define tracef(...) do { if (trace_enabled) HOST_TIMED(HOST_TRACE, printf(__VA_ARGS__)); } while (0)
+void host_profile_merge();
+#else
+#define HOST_TIMER_START(section) do { } while (0)
+#define HOST_TIMER_STOP(section) do { } while (0)
+#define HOST_TIMED(section, ...) do { __VA_ARGS__; } while (0)
+#define tracef(...) do { if (trace_enabled) printf(__VA_ARGS__); } while (0)
+#define host_profile_merge() do { } while (0)
+#endif
 
 // --- Helper: Get Opcode Name ---
 const char* get_opcode_name(uint8_t opcode_val) {
@@ -81,7 +469,8 @@ const char* get_opcode_name(uint8_t opcode_val) {
         case OPCODE_ORI: return "ORI";  case OPCODE_J:   return "J";
         case OPCODE_SLL: return "SLL";  case OPCODE_SRL: return "SRL";
         case OPCODE_LW:  return "LW";   case OPCODE_SW:  return "SW";
-        case OPCODE_NOP: return "NOP";
+        case OPCODE_VMEM:return "VMEM"; case OPCODE_VALU:return "VALU";
+        case OPCODE_VSUM:return "VSUM"; case OPCODE_NOP: return "NOP";
         default: return "UNK";
     }
 }
@@ -92,21 +481,43 @@ void initialize_processor() {
     current_cycle = 0;
     halt_simulation = 0;
     instructions_loaded_count = 0;
+    empty_pipeline_cycles = 0;
+    instructions_retired = 0;
+    idle_cycles_skipped = 0;
+    memset(fused_pairs_retired, 0, sizeof(fused_pairs_retired));
+    fetched_pc_this_cycle = -1;
+    fetched_pair_this_cycle = false;
+    clear_dirty_pages();
     memset(memory, 0, sizeof(memory));
     for(int i=0; i<NUM_REGISTERS; ++i) registers[i] = 0;
+    memset(vector_registers, 0, sizeof(vector_registers));
 
     active_in_IF_stage.valid = false;
     active_in_ID_stage.valid = false;
     active_in_EX_stage.valid = false;
     active_in_MEM_stage.valid = false;
     active_in_WB_stage.valid = false;
+    ex_in_flight_count = 0;
+    store_buffer_count = 0;
+    memset(&store_buffer_stats, 0, sizeof(store_buffer_stats));
 
     branch_taken_in_EX_cycle2 = false;
     stall_IF_for_mem_after_branch = false;
     hazard_detected = false;
+    load_use_stall_pc = -1;
+    flush_branch_pc = -1;
 }
 
 // --- Helper Functions for Parsing ---
+// Assembler errors end the process on the command line; the embedding API
+// installs a handler so a bad buffer only fails sim_load_assembly.
+_Thread_local jmp_buf* assembly_error_handler = NULL;
+
+_Noreturn void assembly_error() {
+    if (assembly_error_handler != NULL) longjmp(*assembly_error_handler, 1);
+    exit(1);
+}
+
 uint8_t get_opcode(const char* opcode_str) {
     if (strcmp(opcode_str, "ADD") == 0) return OPCODE_ADD;
     else if (strcmp(opcode_str, "SUB") == 0) return OPCODE_SUB;
@@ -120,10 +531,13 @@ uint8_t get_opcode(const char* opcode_str) {
     else if (strcmp(opcode_str, "SRL") == 0) return OPCODE_SRL;
     else if (strcmp(opcode_str, "LW") == 0) return OPCODE_LW;
     else if (strcmp(opcode_str, "SW") == 0) return OPCODE_SW;
+    else if (strcmp(opcode_str, "VLD") == 0 || strcmp(opcode_str, "VST") == 0) return OPCODE_VMEM;
+    else if (strcmp(opcode_str, "VADD") == 0 || strcmp(opcode_str, "VSUB") == 0) return OPCODE_VALU;
+    else if (strcmp(opcode_str, "VSUM") == 0) return OPCODE_VSUM;
     else if (strcmp(opcode_str, "NOP") == 0) return OPCODE_NOP;
     else {
         printf("Unknown opcode: %s\n", opcode_str);
-        exit(1);
+        assembly_error();
     }
 }
 
@@ -138,11 +552,15 @@ char get_instruction_type(const char* opcode_str) {
         return 'I';
     } else if (strcmp(opcode_str, "J") == 0) {
         return 'J';
+    } else if (strcmp(opcode_str, "VLD") == 0 || strcmp(opcode_str, "VST") == 0 ||
+               strcmp(opcode_str, "VADD") == 0 || strcmp(opcode_str, "VSUB") == 0 ||
+               strcmp(opcode_str, "VSUM") == 0) {
+        return 'V';
     } else if (strcmp(opcode_str, "NOP") == 0) {
         return 'N';
     } else {
         printf("Unknown opcode: %s\n", opcode_str);
-        exit(1);
+        assembly_error();
     }
 }
 
@@ -152,122 +570,641 @@ int parse_register(const char* reg_str) {
         if (reg_num >= 0 && reg_num < 32) return reg_num;
     }
     printf("Invalid register: %s\n", reg_str);
-    exit(1);
+    assembly_error();
 }
 
-int parse_immediate(const char* imm_str) {
-    return atoi(imm_str);
+int parse_vector_register(const char* reg_str) {
+    if (reg_str[0] == 'V') {
+        int reg_num = atoi(reg_str + 1);
+        if (reg_num >= 0 && reg_num < NUM_VECTOR_REGISTERS) return reg_num;
+    }
+    printf("Invalid vector register: %s\n", reg_str);
+    assembly_error();
 }
 
-// --- Load Assembly File ---
-void load_assembly_file(const char* filename) {
-    FILE* file = fopen(filename, "r");
-    if (file == NULL) {
-        printf("Error opening file: %s\n", filename);
-        exit(1);
+// --- Assembler Symbols ---
+// Labels ("name:") and .equ constants. assemble_source makes two passes: the
+// first only assigns addresses, the second encodes, so a label can be used
+// before the line that defines it.
+#define MAX_SYMBOLS     256
+#define MAX_SYMBOL_NAME 32
+
+typedef struct {
+    char    name[MAX_SYMBOL_NAME];
+    int32_t value;
+    bool    is_code_label; // Instruction address: a BNE operand becomes PC-relative
+} AssemblySymbol;
+
+_Thread_local AssemblySymbol assembly_symbols[MAX_SYMBOLS];
+_Thread_local int  assembly_symbol_count = 0;
+_Thread_local int  assembly_pass = 2;                  // 1 = collecting symbols
+_Thread_local bool assembly_forward_reference = false; // Pass 1 read an undefined symbol as 0
+_Thread_local int  data_words_loaded = 0;              // Words preloaded by .word/.fill
+
+AssemblySymbol* find_symbol(const char* name, size_t length) {
+    for (int s = 0; s < assembly_symbol_count; s++) {
+        if (strlen(assembly_symbols[s].name) == length && strncmp(assembly_symbols[s].name, name, length) == 0) {
+            return &assembly_symbols[s];
+        }
     }
-    int i = 0;
-    char line[256];
-    while (fgets(line, sizeof(line), file) != NULL) {
-        // Trim leading whitespace
-        char* ptr = line;
-        while (*ptr == ' ' || *ptr == '\t') ptr++;
-        if (*ptr == '\n' || *ptr == '\0') continue; // Skip empty lines
-        // Tokenize
-        char* tokens[5];
-        int token_count = 0;
-        char* token = strtok(ptr, " \t\n");
-        while (token != NULL && token_count < 5) {
-            tokens[token_count++] = token;
-            token = strtok(NULL, " \t\n");
+    return NULL;
+}
+
+void define_symbol(const char* name, int32_t value, bool is_code_label) {
+    size_t length = strlen(name);
+    bool valid = length > 0 && length < MAX_SYMBOL_NAME && (isalpha((unsigned char)name[0]) || name[0] == '_');
+    for (size_t c = 1; valid && c < length; c++) valid = isalnum((unsigned char)name[c]) || name[c] == '_';
+    if (!valid) {
+        printf("Invalid symbol name: %s\n", name);
+        assembly_error();
+    }
+    AssemblySymbol* symbol = find_symbol(name, length);
+    if (symbol != NULL) {
+        if (assembly_pass == 1) {
+            printf("Duplicate symbol: %s\n", name);
+            assembly_error();
         }
-        if (token_count == 0) continue;
-        const char* opcode_str = tokens[0];
-        char type = get_instruction_type(opcode_str);
-        uint32_t instruction = 0;
-        if (type == 'R') {
+        symbol->value = value; // .equ is evaluated again in pass 2
+        return;
+    }
+    if (assembly_symbol_count == MAX_SYMBOLS) {
+        printf("Too many symbols (limit %d)\n", MAX_SYMBOLS);
+        assembly_error();
+    }
+    symbol = &assembly_symbols[assembly_symbol_count++];
+    snprintf(symbol->name, sizeof(symbol->name), "%s", name);
+    symbol->value = value;
+    symbol->is_code_label = is_code_label;
+}
+
+int32_t parse_number(const char* text) {
+    const char* digits = (text[0] == '-' || text[0] == '+') ? text + 1 : text;
+    if (digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X')) return (int32_t)strtol(text, NULL, 16);
+    return atoi(text);
+}
+
+// A number (decimal or 0x hex), a symbol, or symbol+number / symbol-number.
+// *code_label tells whether the symbol is an instruction label.
+int32_t resolve_immediate(const char* text, bool* code_label) {
+    *code_label = false;
+    if (!isalpha((unsigned char)text[0]) && text[0] != '_') return parse_number(text);
+    size_t length = strcspn(text, "+-");
+    int32_t offset = text[length] != '\0' ? parse_number(text + length) : 0;
+    AssemblySymbol* symbol = find_symbol(text, length);
+    if (symbol == NULL) {
+        if (assembly_pass == 1) {
+            assembly_forward_reference = true;
+            return offset;
+        }
+        printf("Undefined symbol: %.*s\n", (int)length, text);
+        assembly_error();
+    }
+    *code_label = symbol->is_code_label;
+    return symbol->value + offset;
+}
+
+int parse_immediate(const char* imm_str) {
+    bool code_label;
+    return resolve_immediate(imm_str, &code_label);
+}
+
+// BNE takes a numeric offset as before, or a label it should branch to.
+int parse_branch_offset(const char* operand, int pc) {
+    bool code_label;
+    int32_t value = resolve_immediate(operand, &code_label);
+    return code_label ? value - (pc + 1) : value;
+}
+
+// Encodes one instruction line already split into tokens (opcode first).
+// pc is the instruction's own address, for label-relative BNE offsets.
+uint32_t encode_instruction(char** tokens, int token_count, int pc, const char* line) {
+    const char* opcode_str = tokens[0];
+    char type = get_instruction_type(opcode_str);
+    uint32_t instruction = 0;
+    if (type == 'R') {
+        if (token_count != 4) {
+            printf("Invalid R-type instruction: %s\n", line);
+            assembly_error();
+        }
+        uint8_t r1 = parse_register(tokens[1]);
+        uint8_t r2 = parse_register(tokens[2]);
+        uint32_t shamt = 0;
+        uint8_t r3 = 0;
+        if (strcmp(opcode_str, "SLL") == 0 || strcmp(opcode_str, "SRL") == 0) {
+            shamt = parse_immediate(tokens[3]);
+            if (shamt > 0x1FFF) { // 13-bit limit
+                printf("Shift amount too large: %s\n", tokens[3]);
+                assembly_error();
+            }
+        } else {
+            r3 = parse_register(tokens[3]);
+        }
+        uint8_t opcode = get_opcode(opcode_str);
+        instruction = (opcode << 28) | (r1 << 23) | (r2 << 18) | (r3 << 13) | shamt;
+    } else if (type == 'I') {
+        uint8_t r1, r2;
+        int32_t imm;
+        if (strcmp(opcode_str, "LW") == 0 || strcmp(opcode_str, "SW") == 0) {
+            if (token_count != 3) {
+                printf("Invalid LW/SW instruction: %s\n", line);
+                assembly_error();
+            }
+            r1 = parse_register(tokens[1]);
+            char* offset_str = strtok(tokens[2], "(");
+            char* rs_str = strtok(NULL, ")");
+            if (offset_str == NULL || rs_str == NULL) {
+                printf("Invalid memory address format: %s\n", tokens[2]);
+                assembly_error();
+            }
+            imm = parse_immediate(offset_str);
+            r2 = parse_register(rs_str);
+        } else {
             if (token_count != 4) {
-                printf("Invalid R-type instruction: %s\n", line);
-                exit(1);
+                printf("Invalid I-type instruction: %s\n", line);
+                assembly_error();
+            }
+            r1 = parse_register(tokens[1]);
+            r2 = parse_register(tokens[2]);
+            imm = strcmp(opcode_str, "BNE") == 0 ? parse_branch_offset(tokens[3], pc)
+                                                 : parse_immediate(tokens[3]);
+        }
+        uint8_t opcode = get_opcode(opcode_str);
+        instruction = (opcode << 28) | (r1 << 23) | (r2 << 18) | (imm & 0x3FFFF);
+    } else if (type == 'J') {
+        if (token_count != 2) {
+            printf("Invalid J-type instruction: %s\n", line);
+            assembly_error();
+        }
+        uint32_t address = parse_immediate(tokens[1]);
+        uint8_t opcode = get_opcode(opcode_str);
+        instruction = (opcode << 28) | (address & 0x0FFFFFFF);
+    } else if (type == 'V') {
+        uint8_t opcode = get_opcode(opcode_str);
+        if (opcode == OPCODE_VMEM) {
+            // VLD/VST Vd offset(Rs): 17-bit offset, bit 17 selects the store
+            if (token_count != 3) {
+                printf("Invalid VLD/VST instruction: %s\n", line);
+                assembly_error();
+            }
+            uint8_t v1 = parse_vector_register(tokens[1]);
+            char* offset_str = strtok(tokens[2], "(");
+            char* rs_str = strtok(NULL, ")");
+            if (offset_str == NULL || rs_str == NULL) {
+                printf("Invalid memory address format: %s\n", tokens[2]);
+                assembly_error();
+            }
+            int32_t imm = parse_immediate(offset_str);
+            uint8_t r2 = parse_register(rs_str);
+            instruction = (opcode << 28) | (v1 << 23) | (r2 << 18) | (imm & 0x1FFFF);
+            if (strcmp(opcode_str, "VST") == 0) instruction |= VMEM_STORE_BIT;
+        } else if (opcode == OPCODE_VALU) {
+            if (token_count != 4) {
+                printf("Invalid VADD/VSUB instruction: %s\n", line);
+                assembly_error();
+            }
+            uint8_t v1 = parse_vector_register(tokens[1]);
+            uint8_t v2 = parse_vector_register(tokens[2]);
+            uint8_t v3 = parse_vector_register(tokens[3]);
+            instruction = (opcode << 28) | (v1 << 23) | (v2 << 18) | (v3 << 13);
+            if (strcmp(opcode_str, "VSUB") == 0) instruction |= VALU_SUB_BIT;
+        } else {
+            // VSUM Rd Vs
+            if (token_count != 3) {
+                printf("Invalid VSUM instruction: %s\n", line);
+                assembly_error();
             }
             uint8_t r1 = parse_register(tokens[1]);
-            uint8_t r2 = parse_register(tokens[2]);
-            uint32_t shamt = 0;
-            uint8_t r3 = 0;
-            if (strcmp(opcode_str, "SLL") == 0 || strcmp(opcode_str, "SRL") == 0) {
-                shamt = parse_immediate(tokens[3]);
-                if (shamt > 0x1FFF) { // 13-bit limit
-                    printf("Shift amount too large: %s\n", tokens[3]);
-                    exit(1);
-                }
-            } else {
-                r3 = parse_register(tokens[3]);
-            }
-            uint8_t opcode = get_opcode(opcode_str);
-            instruction = (opcode << 28) | (r1 << 23) | (r2 << 18) | (r3 << 13) | shamt;
-        } else if (type == 'I') {
-            uint8_t r1, r2;
-            int32_t imm;
-            if (strcmp(opcode_str, "LW") == 0 || strcmp(opcode_str, "SW") == 0) {
-                if (token_count != 3) {
-                    printf("Invalid LW/SW instruction: %s\n", line);
-                    exit(1);
-                }
-                r1 = parse_register(tokens[1]);
-                char* offset_str = strtok(tokens[2], "(");
-                char* rs_str = strtok(NULL, ")");
-                if (offset_str == NULL || rs_str == NULL) {
-                    printf("Invalid memory address format: %s\n", tokens[2]);
-                    exit(1);
-                }
-                imm = parse_immediate(offset_str);
-                r2 = parse_register(rs_str);
-            } else {
-                if (token_count != 4) {
-                    printf("Invalid I-type instruction: %s\n", line);
-                    exit(1);
-                }
-                r1 = parse_register(tokens[1]);
-                r2 = parse_register(tokens[2]);
-                imm = parse_immediate(tokens[3]);
-            }
-            uint8_t opcode = get_opcode(opcode_str);
-            instruction = (opcode << 28) | (r1 << 23) | (r2 << 18) | (imm & 0x3FFFF);
-        } else if (type == 'J') {
-            if (token_count != 2) {
-                printf("Invalid J-type instruction: %s\n", line);
-                exit(1);
+            uint8_t v2 = parse_vector_register(tokens[2]);
+            instruction = (opcode << 28) | (r1 << 23) | (v2 << 18);
+        }
+    } else if (type == 'N') {
+        if (token_count != 1) {
+            printf("Invalid NOP instruction: %s\n", line);
+            assembly_error();
+        }
+        instruction = (OPCODE_NOP << 28);
+    }
+    return instruction;
+}
+
+void emit_data_word(int* data_pc, int32_t value) {
+    if (*data_pc >= MEMORY_SIZE) {
+        printf("Data does not fit below address %d\n", MEMORY_SIZE);
+        assembly_error();
+    }
+    if (assembly_pass == 2) {
+        memory[*data_pc] = (uint32_t)value;
+        data_words_loaded++;
+    }
+    (*data_pc)++;
+}
+
+void assemble_directive(char** tokens, int token_count, bool* in_data, int* data_pc) {
+    const char* directive = tokens[0];
+    if (strcmp(directive, ".text") == 0 && token_count == 1) {
+        *in_data = false;
+    } else if (strcmp(directive, ".data") == 0 && token_count <= 2) {
+        *in_data = true;
+        if (token_count == 2) {
+            int address = parse_immediate(tokens[1]);
+            if (address < DATA_MEM_START || address >= MEMORY_SIZE) {
+                printf("Data address out of range: %s\n", tokens[1]);
+                assembly_error();
             }
-            uint32_t address = parse_immediate(tokens[1]);
-            uint8_t opcode = get_opcode(opcode_str);
-            instruction = (opcode << 28) | (address & 0x0FFFFFFF);
-        } else if (type == 'N') {
-            if (token_count != 1) {
-                printf("Invalid NOP instruction: %s\n", line);
-                exit(1);
+            *data_pc = address;
+        }
+    } else if (strcmp(directive, ".word") == 0 && token_count >= 2 && *in_data) {
+        for (int t = 1; t < token_count; t++) emit_data_word(data_pc, parse_immediate(tokens[t]));
+    } else if (strcmp(directive, ".fill") == 0 && (token_count == 2 || token_count == 3) && *in_data) {
+        int count = parse_immediate(tokens[1]);
+        int32_t value = token_count == 3 ? parse_immediate(tokens[2]) : 0;
+        if (count < 0) {
+            printf("Invalid .fill count: %s\n", tokens[1]);
+            assembly_error();
+        }
+        for (int w = 0; w < count; w++) emit_data_word(data_pc, value);
+    } else if (strcmp(directive, ".equ") == 0 && token_count == 3) {
+        assembly_forward_reference = false;
+        int32_t value = parse_immediate(tokens[2]);
+        if (assembly_forward_reference) {
+            printf(".equ %s uses a symbol that is defined later\n", tokens[1]);
+            assembly_error();
+        }
+        define_symbol(tokens[1], value, false);
+    } else {
+        printf("Invalid directive: %s%s\n", directive,
+               (strcmp(directive, ".word") == 0 || strcmp(directive, ".fill") == 0) && !*in_data ? " (outside .data)" : "");
+        assembly_error();
+    }
+}
+
+// --- Assemble Source Text ---
+// One statement per line; '#' or ';' starts a comment and commas separate
+// operands like spaces. A statement may follow any number of labels
+// ("loop:") and is an instruction or one of:
+//   .text              following lines are instructions (the default)
+//   .data [address]    following .word/.fill fill data memory, from
+//                      DATA_MEM_START or the given address
+//   .word v1 v2 ...    one data word per value
+//   .fill count [v]    count words of v (default 0)
+//   .equ name value    named constant, usable wherever a number is
+// Returns the instruction count.
+#define MAX_LINE_TOKENS 64
+
+int assemble_source(const char* source, size_t length) {
+    int text_pc = 0;
+    assembly_symbol_count = 0;
+    for (assembly_pass = 1; assembly_pass <= 2; assembly_pass++) {
+        int data_pc = DATA_MEM_START;
+        bool in_data = false;
+        char line[256];
+        size_t pos = 0;
+        text_pc = 0;
+        data_words_loaded = 0;
+        while (pos < length) {
+            // Next line (CR dropped, overlong lines truncated)
+            size_t n = 0;
+            while (pos < length && source[pos] != '\n') {
+                if (source[pos] != '\r' && n < sizeof(line) - 1) line[n++] = source[pos];
+                pos++;
+            }
+            if (pos < length) pos++;
+            line[n] = '\0';
+            char* comment = strpbrk(line, "#;");
+            if (comment != NULL) *comment = '\0';
+            // Tokenize
+            char* tokens[MAX_LINE_TOKENS];
+            int token_count = 0;
+            char* token = strtok(line, " \t,");
+            while (token != NULL && token_count < MAX_LINE_TOKENS) {
+                tokens[token_count++] = token;
+                token = strtok(NULL, " \t,");
             }
-            instruction = (OPCODE_NOP << 28);
+            // Labels
+            int first = 0;
+            while (first < token_count && tokens[first][strlen(tokens[first]) - 1] == ':') {
+                tokens[first][strlen(tokens[first]) - 1] = '\0';
+                if (assembly_pass == 1) define_symbol(tokens[first], in_data ? data_pc : text_pc, !in_data);
+                first++;
+            }
+            if (first == token_count) continue; // Empty line or labels only
+            char** statement = &tokens[first];
+            int statement_tokens = token_count - first;
+
+            if (statement[0][0] == '.') {
+                assemble_directive(statement, statement_tokens, &in_data, &data_pc);
+                continue;
+            }
+            if (in_data) {
+                printf("Instruction in .data section: %s\n", statement[0]);
+                assembly_error();
+            }
+            if (text_pc > INSTRUCTION_MEM_END) {
+                printf("Program does not fit in instruction memory (%d words)\n", INSTRUCTION_MEM_END + 1);
+                assembly_error();
+            }
+            if (assembly_pass == 2) memory[text_pc] = encode_instruction(statement, statement_tokens, text_pc, statement[0]);
+            text_pc++;
         }
-        memory[i] = instruction;
-        i++;
     }
-    instructions_loaded_count = i;
+    assembly_pass = 2;
+    instructions_loaded_count = text_pc;
+    return text_pc;
+}
+
+// --- Load Assembly File ---
+void load_assembly_file(const char* filename) {
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        printf("Error opening file: %s\n", filename);
+        exit(1);
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* source = malloc(size > 0 ? size : 1);
+    size_t length = fread(source, 1, size > 0 ? size : 0, file);
     fclose(file);
+    assemble_source(source, length);
+    free(source);
     printf("Loaded %d instructions from %s.\n", instructions_loaded_count, filename);
+    if (data_words_loaded > 0) printf("Preloaded %d data words.\n", data_words_loaded);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////// shared data memory (MSI) ////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// In multi-core mode each core keeps its own instruction image in the
+// thread-local memory[], while the data region DATA_MEM_START..MEMORY_SIZE-1
+// lives in shared_data_memory behind a small direct-mapped cache per core,
+// kept coherent with MSI. The bus lock serializes all cache/snoop activity.
+#define MAX_CORES        16
+#define CACHE_LINE_WORDS 4
+#define CACHE_NUM_LINES  16
+
+#define LINE_INVALID  0
+#define LINE_SHARED   1
+#define LINE_MODIFIED 2
+
+typedef struct {
+    uint8_t  state;
+    int      tag; // Address of the first word in the line
+    uint32_t words[CACHE_LINE_WORDS];
+} CacheLine;
+
+typedef struct {
+    CacheLine lines[CACHE_NUM_LINES];
+    long hits, misses, invalidations, writebacks;
+} CoreCache;
+
+bool multicore_enabled = false;
+int  num_cores = 1;
+uint32_t  shared_data_memory[MEMORY_SIZE];
+CoreCache core_caches[MAX_CORES];
+pthread_mutex_t coherence_bus_lock = PTHREAD_MUTEX_INITIALIZER;
+_Thread_local int current_core_id = 0;
+
+void write_back_line(CoreCache* cache, CacheLine* line) {
+    memcpy(&shared_data_memory[line->tag], line->words, sizeof(line->words));
+    cache->writebacks++;
+}
+
+// One load or store by current_core_id. Misses and upgrades snoop the other
+// caches: a Modified copy is written back, then downgraded (read) or
+// invalidated (write).
+uint32_t coherent_access(int address, bool is_write, uint32_t value) {
+    CoreCache* cache = &core_caches[current_core_id];
+    int tag = address - address % CACHE_LINE_WORDS;
+    int index = (address / CACHE_LINE_WORDS) % CACHE_NUM_LINES;
+    CacheLine* line = &cache->lines[index];
+
+    pthread_mutex_lock(&coherence_bus_lock);
+    bool present = line->state != LINE_INVALID && line->tag == tag;
+    if (present && (!is_write || line->state == LINE_MODIFIED)) {
+        cache->hits++;
+    } else {
+        cache->misses++;
+        if (!present && line->state == LINE_MODIFIED) write_back_line(cache, line);
+        for (int c = 0; c < num_cores; c++) {
+            if (c == current_core_id) continue;
+            CacheLine* other = &core_caches[c].lines[index];
+            if (other->state == LINE_INVALID || other->tag != tag) continue;
+            if (other->state == LINE_MODIFIED) write_back_line(&core_caches[c], other);
+            if (is_write) {
+                other->state = LINE_INVALID;
+                core_caches[c].invalidations++;
+            } else {
+                other->state = LINE_SHARED;
+            }
+        }
+        if (!present) {
+            memcpy(line->words, &shared_data_memory[tag], sizeof(line->words));
+            line->tag = tag;
+        }
+        line->state = is_write ? LINE_MODIFIED : LINE_SHARED;
+    }
+    if (is_write) line->words[address - tag] = value;
+    uint32_t result = line->words[address - tag];
+    pthread_mutex_unlock(&coherence_bus_lock);
+    return result;
+}
+
+// Data-region accessors used by the MEM stage (address already validated).
+uint32_t data_memory_read(int address) {
+    if (multicore_enabled) return coherent_access(address, false, 0);
+    return memory[address];
+}
+
+void data_memory_write(int address, uint32_t value) {
+    if (multicore_enabled) {
+        coherent_access(address, true, value);
+        return;
+    }
+    memory[address] = value;
+    mark_page_dirty(address);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////// memory-mapped I/O //////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Streaming ports just above data memory, reached with LW/SW like any other
+// address (e.g. LW R1 2048(R0)). Both streams are raw little-endian 32-bit
+// words in host files (--input / --output), moved in large blocks so a
+// program can work through datasets far bigger than MEMORY_SIZE.
+#define IO_PORT_BASE    MEMORY_SIZE
+#define IO_INPUT_DATA   (IO_PORT_BASE + 0) // LW: next input word, 0 once the stream is exhausted
+#define IO_INPUT_STATUS (IO_PORT_BASE + 1) // LW: 1 while input words remain, else 0
+#define IO_OUTPUT_DATA  (IO_PORT_BASE + 2) // SW: append a word to the output stream
+#define IO_NUM_PORTS    3
+#define IO_BUFFER_WORDS 16384
+
+typedef struct {
+    FILE*       file;
+    const char* name;
+    uint32_t    buffer[IO_BUFFER_WORDS];
+    size_t      count; // Input: words in buffer; output: words waiting to be written
+    size_t      next;  // Input: next word to hand out
+    long        transferred;
+} IoStream;
+
+IoStream io_input, io_output;
+pthread_mutex_t io_lock = PTHREAD_MUTEX_INITIALIZER; // Every thread shares the streams
+
+bool is_io_port(int address) {
+    return address >= IO_PORT_BASE && address < IO_PORT_BASE + IO_NUM_PORTS;
+}
+
+void open_io_stream(IoStream* stream, const char* filename, const char* mode) {
+    stream->file = fopen(filename, mode);
+    if (stream->file == NULL) {
+        printf("Error opening file: %s\n", filename);
+        exit(1);
+    }
+    stream->name = filename;
+}
+
+void swap_words_to_host(uint32_t* words, size_t count) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    for (size_t i = 0; i < count; i++) words[i] = __builtin_bswap32(words[i]);
+#else
+    (void)words;
+    (void)count;
+#endif
+}
+
+bool io_input_available() {
+    if (io_input.next == io_input.count && io_input.file != NULL) {
+        io_input.count = fread(io_input.buffer, sizeof(uint32_t), IO_BUFFER_WORDS, io_input.file);
+        io_input.next = 0;
+        swap_words_to_host(io_input.buffer, io_input.count);
+        if (io_input.count == 0) {
+            fclose(io_input.file);
+            io_input.file = NULL;
+        }
+    }
+    return io_input.next < io_input.count;
+}
+
+void flush_io_output() {
+    if (io_output.file == NULL || io_output.count == 0) return;
+    swap_words_to_host(io_output.buffer, io_output.count); // Back to little-endian
+    fwrite(io_output.buffer, sizeof(uint32_t), io_output.count, io_output.file);
+    io_output.count = 0;
+}
+
+uint32_t io_port_read(int address) {
+    uint32_t value = 0;
+    pthread_mutex_lock(&io_lock);
+    if (address == IO_INPUT_STATUS) {
+        value = io_input_available();
+    } else if (address == IO_INPUT_DATA && io_input_available()) {
+        value = io_input.buffer[io_input.next++];
+        io_input.transferred++;
+    }
+    pthread_mutex_unlock(&io_lock);
+    return value;
+}
+
+void io_port_write(int address, uint32_t value) {
+    if (address != IO_OUTPUT_DATA || io_output.file == NULL) return;
+    pthread_mutex_lock(&io_lock);
+    io_output.buffer[io_output.count++] = value;
+    io_output.transferred++;
+    if (io_output.count == IO_BUFFER_WORDS) flush_io_output();
+    pthread_mutex_unlock(&io_lock);
+}
+
+// Registered with atexit once a stream is opened, so every mode flushes.
+void close_io_streams() {
+    if (io_input.name != NULL) printf("I/O: %ld words read from %s\n", io_input.transferred, io_input.name);
+    if (io_output.name != NULL) {
+        flush_io_output();
+        fclose(io_output.file);
+        io_output.file = NULL;
+        printf("I/O: %ld words written to %s\n", io_output.transferred, io_output.name);
+    }
+    if (io_input.file != NULL) fclose(io_input.file);
+    io_input.file = NULL;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////fetch///////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// Which pair an ADDI forms with the instruction after it. The second one must
+// read the ADDI's result (the BNE compare, the LW/SW base), so the fused
+// micro-op computes the ADDI in EX and feeds it straight into the second
+// instruction instead of forwarding it through a separate ID/EX pass.
+int fusion_kind(uint32_t first, uint32_t second) {
+    if (!pipeline_config.fusion || ((first >> 28) & 0xF) != OPCODE_ADDI) return FUSION_NONE;
+    uint32_t rx = (first >> 23) & 0x1F;
+    uint32_t r1 = (second >> 23) & 0x1F, r2 = (second >> 18) & 0x1F;
+    if (rx == 0) return FUSION_NONE;
+    switch ((second >> 28) & 0xF) {
+        case OPCODE_BNE: return (r1 == rx || r2 == rx) ? FUSION_ADDI_BNE : FUSION_NONE;
+        case OPCODE_LW:  return r2 == rx ? FUSION_ADDI_LW : FUSION_NONE;
+        case OPCODE_SW:  return r2 == rx ? FUSION_ADDI_SW : FUSION_NONE;
+        default:         return FUSION_NONE;
+    }
+}
+
+const char* fusion_name(int kind) {
+    switch (kind) {
+        case FUSION_ADDI_BNE: return "ADDI+BNE";
+        case FUSION_ADDI_LW:  return "ADDI+LW";
+        case FUSION_ADDI_SW:  return "ADDI+SW";
+        default:              return "none";
+    }
+}
+
+void print_fusion_report() {
+    long pairs = 0;
+    for (int kind = 1; kind < NUM_FUSION_KINDS; kind++) pairs += fused_pairs_retired[kind];
+    printf("Macro-op fusion: %ld pairs retired as one micro-op (", pairs);
+    for (int kind = 1; kind < NUM_FUSION_KINDS; kind++) {
+        printf("%s%s %ld", kind > 1 ? ", " : "", fusion_name(kind), fused_pairs_retired[kind]);
+    }
+    printf("), CPI %.2f\n", instructions_retired > 0 ? current_cycle / (double)instructions_retired : 0.0);
+}
+
+// Fusion of the pair starting at pc, given the program image.
+int fusion_at(const uint32_t* image, int32_t pc, int length) {
+    if (pc + 1 >= length || pc + 1 > INSTRUCTION_MEM_END) return FUSION_NONE;
+    return fusion_kind(image[pc], image[pc + 1]);
+}
+
 void fetch_instruction_stage_op() {
     if (!can_IF_operate_this_cycle) {
-        printf("Cycle %d: IF - Idle (MEM active or stalled).\n", current_cycle);
+        tracef("Cycle %d: IF - Idle (MEM active or stalled).\n", current_cycle);
         active_in_IF_stage.valid = false;
         return;
     }
 
-    if (PC < instructions_loaded_count && PC <= INSTRUCTION_MEM_END) {
+    if (PC >= 0 && PC < instructions_loaded_count && PC <= INSTRUCTION_MEM_END) {
+        // A fusable pair is fetched in one port cycle and travels as the
+        // second instruction, carrying the ADDI in fused_raw.
+        int fusion = fusion_at(memory, PC, instructions_loaded_count);
+        active_in_IF_stage.fusion = fusion;
+        if (fusion != FUSION_NONE) {
+            active_in_IF_stage.fused_raw = memory[PC];
+            active_in_IF_stage.raw_instruction = memory[PC + 1];
+            active_in_IF_stage.instruction_pc_at_fetch = PC;
+            active_in_IF_stage.valid = true;
+            active_in_IF_stage.cycles_spent_in_stage = 0;
+            active_in_IF_stage.decoded_info.original_pc = PC + 1;
+            active_in_IF_stage.decoded_info.opcode = (active_in_IF_stage.raw_instruction >> 28) & 0xF;
+            tracef("Cycle %d: IF - Inputs: PC=%d\n", current_cycle, PC);
+            tracef("Cycle %d: IF - Fetched instr %d+%d (0x%08X 0x%08X, %s) from Mem[%d..%d] as one micro-op.\n",
+                   current_cycle, PC, PC + 1, active_in_IF_stage.fused_raw, active_in_IF_stage.raw_instruction,
+                   fusion_name(fusion), PC, PC + 1);
+            tracef("Cycle %d: IF - Outputs: RawInstr=0x%08X, NextPC=%d\n", current_cycle, active_in_IF_stage.raw_instruction, PC + 2);
+            fetched_pc_this_cycle = PC;
+            fetched_pair_this_cycle = true;
+            PC += 2;
+            return;
+        }
         active_in_IF_stage.raw_instruction = memory[PC];
         active_in_IF_stage.instruction_pc_at_fetch = PC;
         active_in_IF_stage.valid = true;
@@ -275,27 +1212,21 @@ void fetch_instruction_stage_op() {
         active_in_IF_stage.decoded_info.original_pc = PC;
         active_in_IF_stage.decoded_info.opcode = (active_in_IF_stage.raw_instruction >> 28) & 0xF;
 
-        printf("Cycle %d: IF - Inputs: PC=%d\n", current_cycle, PC);
-        printf("Cycle %d: IF - Fetched instr %d (0x%08X, %s) from Mem[%d].\n",
+        tracef("Cycle %d: IF - Inputs: PC=%d\n", current_cycle, PC);
+        tracef("Cycle %d: IF - Fetched instr %d (0x%08X, %s) from Mem[%d].\n",
                current_cycle, PC, active_in_IF_stage.raw_instruction, get_opcode_name(active_in_IF_stage.decoded_info.opcode), PC);
-        printf("Cycle %d: IF - Outputs: RawInstr=0x%08X, NextPC=%d\n", current_cycle, active_in_IF_stage.raw_instruction, PC + 1);
+        tracef("Cycle %d: IF - Outputs: RawInstr=0x%08X, NextPC=%d\n", current_cycle, active_in_IF_stage.raw_instruction, PC + 1);
+        fetched_pc_this_cycle = PC;
         PC++;
     } else {
-        if (PC >= instructions_loaded_count && !halt_simulation) {
-            // printf("Cycle %d: IF - No more instructions to fetch (PC=%d). Fetching NOP.\n", current_cycle, PC);
-        } else if (PC > INSTRUCTION_MEM_END && !halt_simulation) {
-            printf("Cycle %d: IF - PC (%d) out of instruction memory. Fetching NOP.\n", current_cycle, PC);
+        // Nothing left to fetch: leave IF empty so the pipeline can drain and
+        // the halt check in simulate_clock_cycle can fire.
+        if (PC > INSTRUCTION_MEM_END || PC < 0) {
+            tracef("Cycle %d: IF - PC (%d) out of instruction memory. Nothing fetched.\n", current_cycle, PC);
+        } else {
+            tracef("Cycle %d: IF - No more instructions to fetch (PC=%d).\n", current_cycle, PC);
         }
-        active_in_IF_stage.raw_instruction = (OPCODE_NOP << 28);
-        active_in_IF_stage.instruction_pc_at_fetch = PC;
-        active_in_IF_stage.valid = true;
-        active_in_IF_stage.cycles_spent_in_stage = 0;
-        active_in_IF_stage.decoded_info.original_pc = PC;
-        active_in_IF_stage.decoded_info.opcode = OPCODE_NOP;
-        active_in_IF_stage.decoded_info.type = 'N';
-        printf("Cycle %d: IF - Inputs: PC=%d\n", current_cycle, PC);
-        printf("Cycle %d: IF - Fetched NOP (0x%08X) for PC=%d.\n", current_cycle, active_in_IF_stage.raw_instruction, PC);
-        printf("Cycle %d: IF - Outputs: RawInstr=0x%08X, NextPC=%d\n", current_cycle, active_in_IF_stage.raw_instruction, PC);
+        active_in_IF_stage.valid = false;
     }
 }
 
@@ -303,41 +1234,166 @@ void fetch_instruction_stage_op() {
 ////////////////////////////////////////////// decode (el teneen) ///////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// Reads a source operand in ID's last cycle, taking the newest in-flight value
+// from EX (result computed), MEM or WB before falling back to the register file.
+bool forwards_R1(const PipelineRegister* stage) {
+    return stage->valid &&
+           stage->decoded_info.opcode != OPCODE_BNE &&
+           stage->decoded_info.opcode != OPCODE_J &&
+           stage->decoded_info.opcode != OPCODE_SW;
+}
+
+// A fused micro-op writes two registers: the fused ADDI's destination and
+// then its own R1 (LW), which wins when both are the same register.
+bool writes_register(const PipelineRegister* stage, uint32_t reg_idx) {
+    return (forwards_R1(stage) && stage->decoded_info.R1_idx == reg_idx) ||
+           (stage->valid && stage->decoded_info.fused_R1_idx == reg_idx);
+}
+
+bool loads_register(const PipelineRegister* stage, uint32_t reg_idx) {
+    return stage->decoded_info.opcode == OPCODE_LW && stage->decoded_info.R1_idx == reg_idx;
+}
+
+int32_t forwarded_value(const PipelineRegister* stage, uint32_t reg_idx) {
+    if (!forwards_R1(stage) || stage->decoded_info.R1_idx != reg_idx) return stage->decoded_info.fused_result;
+    return (stage->decoded_info.opcode == OPCODE_LW) ? stage->decoded_info.mem_read_val
+                                                      : stage->decoded_info.alu_result;
+}
+
+// Newest producer of reg_idx in the EX latch or in ex_in_flight, or NULL.
+const PipelineRegister* ex_producer_of(uint32_t reg_idx) {
+    if (writes_register(&active_in_EX_stage, reg_idx)) return &active_in_EX_stage;
+    for (int i = ex_in_flight_count - 1; i >= 0; i--) {
+        if (writes_register(&ex_in_flight[i], reg_idx)) return &ex_in_flight[i];
+    }
+    return NULL;
+}
+
+int32_t select_forwarded_register(uint32_t reg_idx) {
+    if (reg_idx == 0) return 0;
+    if (!pipeline_config.forwarding) return registers[reg_idx]; // source_operands_pending waited for WB
+    const PipelineRegister* ex = ex_producer_of(reg_idx);
+    if (ex != NULL && ex_result_ready(ex)) {
+        int32_t value = loads_register(ex, reg_idx) ? ex->decoded_info.alu_result : forwarded_value(ex, reg_idx);
+        tracef("Cycle %d: ID - Forwarding R%d value %d from EX\n", current_cycle, reg_idx, value);
+        return value;
+    }
+    if (writes_register(&active_in_MEM_stage, reg_idx)) {
+        int32_t value = forwarded_value(&active_in_MEM_stage, reg_idx);
+        tracef("Cycle %d: ID - Forwarding R%d value %d from MEM\n", current_cycle, reg_idx, value);
+        return value;
+    }
+    if (writes_register(&active_in_WB_stage, reg_idx)) {
+        int32_t value = forwarded_value(&active_in_WB_stage, reg_idx);
+        tracef("Cycle %d: ID - Forwarding R%d value %d from WB\n", current_cycle, reg_idx, value);
+        return value;
+    }
+    return registers[reg_idx];
+}
+
+int32_t read_forwarded_register(uint32_t reg_idx) {
+    int32_t value;
+    HOST_TIMED(HOST_FORWARD, value = select_forwarded_register(reg_idx));
+    return value;
+}
+
+// True if the newest in-flight producer of reg_idx cannot supply its value
+// yet: its result is not computed (EX not finished, LW before its MEM cycle)
+// or forwarding is off and it has not been written back.
+bool operand_pending(uint32_t reg_idx) {
+    if (reg_idx == 0) return false;
+    const PipelineRegister* ex = ex_producer_of(reg_idx);
+    if (ex != NULL) {
+        return EX_producer_pending(loads_register(ex, reg_idx), ex->cycles_spent_in_stage,
+                                   ex_latency_of(ex->decoded_info.opcode));
+    }
+    if (writes_register(&active_in_MEM_stage, reg_idx)) {
+        return MEM_producer_pending(loads_register(&active_in_MEM_stage, reg_idx),
+                                    active_in_MEM_stage.cycles_spent_in_stage,
+                                    mem_latency_of(active_in_MEM_stage.decoded_info.opcode));
+    }
+    return false;
+}
+
+// The sources of raw_instr (and of the ADDI fused ahead of it, if fused)
+// that are not ready yet (decode_source_registers).
+bool source_operands_pending(uint32_t raw_instr, uint32_t fused_raw, bool fused) {
+    uint32_t sources[3];
+    int n = decode_source_registers((raw_instr >> 28) & 0xF, (raw_instr >> 23) & 0x1F, (raw_instr >> 18) & 0x1F,
+                                    (raw_instr >> 13) & 0x1F, fused ? (fused_raw >> 23) & 0x1F : 0,
+                                    (fused_raw >> 18) & 0x1F, sources);
+    for (int i = 0; i < n; i++) {
+        if (operand_pending(sources[i])) return true;
+    }
+    return false;
+}
+
+// The LW in EX writes a register named anywhere in raw_instr.
+bool load_use_hazard(uint32_t raw_instr) {
+    return active_in_EX_stage.valid && active_in_EX_stage.decoded_info.opcode == OPCODE_LW &&
+           load_use_conflict(active_in_EX_stage.decoded_info.R1_idx, (raw_instr >> 28) & 0xF,
+                             (raw_instr >> 23) & 0x1F, (raw_instr >> 18) & 0x1F, (raw_instr >> 13) & 0x1F);
+}
 
 void decode_instruction_stage_op() {
+    hazard_detected = false;
     if (!active_in_ID_stage.valid) return;
 
     active_in_ID_stage.cycles_spent_in_stage++;
     DecodedInstruction* decoded = &active_in_ID_stage.decoded_info;
 
+    bool fused = active_in_ID_stage.fusion != FUSION_NONE;
     if (active_in_ID_stage.cycles_spent_in_stage == 1) {
         decoded->opcode = (active_in_ID_stage.raw_instruction >> 28) & 0xF;
-        decoded->original_pc = active_in_ID_stage.instruction_pc_at_fetch;
-        printf("Cycle %d: ID - Inputs: RawInstr=0x%08X\n", current_cycle, active_in_ID_stage.raw_instruction);
-        printf("Cycle %d: ID - Instr %d (0x%08X, %s) entered ID (1st cycle).\n",
+        decoded->original_pc = active_in_ID_stage.instruction_pc_at_fetch + fused;
+        tracef("Cycle %d: ID - Inputs: RawInstr=0x%08X\n", current_cycle, active_in_ID_stage.raw_instruction);
+        tracef("Cycle %d: ID - Instr %d (0x%08X, %s) entered ID (1st cycle).\n",
                current_cycle, decoded->original_pc, active_in_ID_stage.raw_instruction, get_opcode_name(decoded->opcode));
-        printf("Cycle %d: ID - Outputs: Opcode=%s\n", current_cycle, get_opcode_name(decoded->opcode));
-    } else if (active_in_ID_stage.cycles_spent_in_stage == 2) {
+        tracef("Cycle %d: ID - Outputs: Opcode=%s\n", current_cycle, get_opcode_name(decoded->opcode));
+    }
+    if (active_in_ID_stage.cycles_spent_in_stage == pipeline_config.id_latency) {
         uint32_t raw_instr = active_in_ID_stage.raw_instruction;
+        uint32_t fused_raw = active_in_ID_stage.fused_raw;
         decoded->opcode = (raw_instr >> 28) & 0xF;
-        decoded->original_pc = active_in_ID_stage.instruction_pc_at_fetch;
-        printf("Cycle %d: ID - Inputs: RawInstr=0x%08X\n", current_cycle, raw_instr);
-
-        // Check for load-use hazard (LW in EX)
-        hazard_detected = false;
-        if (active_in_EX_stage.valid && active_in_EX_stage.decoded_info.opcode == OPCODE_LW &&
-            active_in_EX_stage.decoded_info.R1_idx != 0 &&
-            (active_in_EX_stage.decoded_info.R1_idx == ((raw_instr >> 23) & 0x1F) ||
-             active_in_EX_stage.decoded_info.R1_idx == ((raw_instr >> 18) & 0x1F) ||
-             (decoded->opcode != OPCODE_SLL && decoded->opcode != OPCODE_SRL &&
-              active_in_EX_stage.decoded_info.R1_idx == ((raw_instr >> 13) & 0x1F)))) {
+        decoded->original_pc = active_in_ID_stage.instruction_pc_at_fetch + fused;
+        tracef("Cycle %d: ID - Inputs: RawInstr=0x%08X\n", current_cycle, raw_instr);
+
+        // Check for load-use hazard (LW in EX), then for any other operand
+        // the current configuration cannot deliver yet
+        bool load_use, stall;
+        HOST_TIMED(HOST_FORWARD,
+                   load_use = load_use_hazard(raw_instr) || (fused && load_use_hazard(fused_raw));
+                   stall = load_use || source_operands_pending(raw_instr, fused_raw, fused));
+        if (stall) {
             hazard_detected = true;
-            printf("Cycle %d: ID - Load-use hazard detected on R%d. Stalling pipeline.\n",
-                   current_cycle, active_in_EX_stage.decoded_info.R1_idx);
-            active_in_ID_stage.cycles_spent_in_stage--; // Stay in ID cycle 2
+            load_use_stall_pc = active_in_ID_stage.instruction_pc_at_fetch;
+            if (load_use) {
+                tracef("Cycle %d: ID - Load-use hazard detected on R%d. Stalling pipeline.\n",
+                       current_cycle, active_in_EX_stage.decoded_info.R1_idx);
+            } else {
+                tracef("Cycle %d: ID - Source operand not ready yet. Stalling pipeline.\n", current_cycle);
+            }
+            // Redo all ID cycles: with the default timing the instruction then
+            // leaves ID on the usual odd cycle (keeping the IF/MEM port
+            // alternation) and the load value can be forwarded from WB.
+            active_in_ID_stage.cycles_spent_in_stage = 0;
             return;
         }
 
+        decoded->fused_R1_idx = 0;
+        if (fused) {
+            int32_t imm_val = fused_raw & 0x3FFFF;
+            if (imm_val & (1 << 17)) {
+                imm_val |= ~0x3FFFF;
+            }
+            decoded->fused_R1_idx = (fused_raw >> 23) & 0x1F;
+            decoded->fused_source = read_forwarded_register((fused_raw >> 18) & 0x1F);
+            decoded->fused_immediate = imm_val;
+            tracef("Cycle %d: ID - Instr %d (ADDI R%u) fused ahead of instr %d (%s).\n", current_cycle,
+                   active_in_ID_stage.instruction_pc_at_fetch, decoded->fused_R1_idx, decoded->original_pc,
+                   get_opcode_name(decoded->opcode));
+        }
+
         switch (decoded->opcode) {
             case OPCODE_ADD: case OPCODE_SUB: case OPCODE_SLL: case OPCODE_SRL:
                 decoded->type = 'R';
@@ -351,84 +1407,11 @@ void decode_instruction_stage_op() {
                     decoded->shamt = 0;
                 }
                 // Forwarding for R2
-                decoded->val_R2_source = 0;
-                if (decoded->R2_idx != 0) {
-                    bool forwarded = false;
-                    if (active_in_EX_stage.valid && active_in_EX_stage.cycles_spent_in_stage == 2 &&
-                        active_in_EX_stage.decoded_info.R1_idx == decoded->R2_idx &&
-                        active_in_EX_stage.decoded_info.opcode != OPCODE_BNE &&
-                        active_in_EX_stage.decoded_info.opcode != OPCODE_J &&
-                        active_in_EX_stage.decoded_info.opcode != OPCODE_SW) {
-                        decoded->val_R2_source = active_in_EX_stage.decoded_info.alu_result;
-                        forwarded = true;
-                        printf("Cycle %d: ID - Forwarding R%d value %d from EX\n",
-                               current_cycle, decoded->R2_idx, decoded->val_R2_source);
-                    } else if (active_in_MEM_stage.valid &&
-                               active_in_MEM_stage.decoded_info.R1_idx == decoded->R2_idx &&
-                               active_in_MEM_stage.decoded_info.opcode != OPCODE_BNE &&
-                               active_in_MEM_stage.decoded_info.opcode != OPCODE_J &&
-                               active_in_MEM_stage.decoded_info.opcode != OPCODE_SW) {
-                        decoded->val_R2_source = (active_in_MEM_stage.decoded_info.opcode == OPCODE_LW) ?
-                                                 active_in_MEM_stage.decoded_info.mem_read_val :
-                                                 active_in_MEM_stage.decoded_info.alu_result;
-                        forwarded = true;
-                        printf("Cycle %d: ID - Forwarding R%d value %d from MEM\n",
-                               current_cycle, decoded->R2_idx, decoded->val_R2_source);
-                    } else if (active_in_WB_stage.valid &&
-                               active_in_WB_stage.decoded_info.R1_idx == decoded->R2_idx &&
-                               active_in_WB_stage.decoded_info.opcode != OPCODE_BNE &&
-                               active_in_WB_stage.decoded_info.opcode != OPCODE_J &&
-                               active_in_WB_stage.decoded_info.opcode != OPCODE_SW) {
-                        decoded->val_R2_source = (active_in_WB_stage.decoded_info.opcode == OPCODE_LW) ?
-                                                 active_in_WB_stage.decoded_info.mem_read_val :
-                                                 active_in_WB_stage.decoded_info.alu_result;
-                        forwarded = true;
-                        printf("Cycle %d: ID - Forwarding R%d value %d from WB\n",
-                               current_cycle, decoded->R2_idx, decoded->val_R2_source);
-                    }
-                    if (!forwarded) {
-                        decoded->val_R2_source = registers[decoded->R2_idx];
-                    }
-                }
+                decoded->val_R2_source = read_forwarded_register(decoded->R2_idx);
                 // Forwarding for R3
                 decoded->val_R3_source = 0;
-                if (decoded->R3_idx != 0 && decoded->opcode != OPCODE_SLL && decoded->opcode != OPCODE_SRL) {
-                    bool forwarded = false;
-                    if (active_in_EX_stage.valid && active_in_EX_stage.cycles_spent_in_stage == 2 &&
-                        active_in_EX_stage.decoded_info.R1_idx == decoded->R3_idx &&
-                        active_in_EX_stage.decoded_info.opcode != OPCODE_BNE &&
-                        active_in_EX_stage.decoded_info.opcode != OPCODE_J &&
-                        active_in_EX_stage.decoded_info.opcode != OPCODE_SW) {
-                        decoded->val_R3_source = active_in_EX_stage.decoded_info.alu_result;
-                        forwarded = true;
-                        printf("Cycle %d: ID - Forwarding R%d value %d from EX\n",
-                               current_cycle, decoded->R3_idx, decoded->val_R3_source);
-                    } else if (active_in_MEM_stage.valid &&
-                               active_in_MEM_stage.decoded_info.R1_idx == decoded->R3_idx &&
-                               active_in_MEM_stage.decoded_info.opcode != OPCODE_BNE &&
-                               active_in_MEM_stage.decoded_info.opcode != OPCODE_J &&
-                               active_in_MEM_stage.decoded_info.opcode != OPCODE_SW) {
-                        decoded->val_R3_source = (active_in_MEM_stage.decoded_info.opcode == OPCODE_LW) ?
-                                                 active_in_MEM_stage.decoded_info.mem_read_val :
-                                                 active_in_MEM_stage.decoded_info.alu_result;
-                        forwarded = true;
-                        printf("Cycle %d: ID - Forwarding R%d value %d from MEM\n",
-                               current_cycle, decoded->R3_idx, decoded->val_R3_source);
-                    } else if (active_in_WB_stage.valid &&
-                               active_in_WB_stage.decoded_info.R1_idx == decoded->R3_idx &&
-                               active_in_WB_stage.decoded_info.opcode != OPCODE_BNE &&
-                               active_in_WB_stage.decoded_info.opcode != OPCODE_J &&
-                               active_in_WB_stage.decoded_info.opcode != OPCODE_SW) {
-                        decoded->val_R3_source = (active_in_WB_stage.decoded_info.opcode == OPCODE_LW) ?
-                                                 active_in_WB_stage.decoded_info.mem_read_val :
-                                                 active_in_WB_stage.decoded_info.alu_result;
-                        forwarded = true;
-                        printf("Cycle %d: ID - Forwarding R%d value %d from WB\n",
-                               current_cycle, decoded->R3_idx, decoded->val_R3_source);
-                    }
-                    if (!forwarded) {
-                        decoded->val_R3_source = registers[decoded->R3_idx];
-                    }
+                if (decoded->opcode != OPCODE_SLL && decoded->opcode != OPCODE_SRL) {
+                    decoded->val_R3_source = read_forwarded_register(decoded->R3_idx);
                 }
                 break;
 
@@ -444,113 +1427,153 @@ void decode_instruction_stage_op() {
                 decoded->immediate = imm_val;
                 // Forwarding for R1 (BNE, SW)
                 decoded->val_R1_source = 0;
-                if ((decoded->opcode == OPCODE_BNE || decoded->opcode == OPCODE_SW) && decoded->R1_idx != 0) {
-                    bool forwarded = false;
-                    if (active_in_EX_stage.valid && active_in_EX_stage.cycles_spent_in_stage == 2 &&
-                        active_in_EX_stage.decoded_info.R1_idx == decoded->R1_idx &&
-                        active_in_EX_stage.decoded_info.opcode != OPCODE_BNE &&
-                        active_in_EX_stage.decoded_info.opcode != OPCODE_J &&
-                        active_in_EX_stage.decoded_info.opcode != OPCODE_SW) {
-                        decoded->val_R1_source = active_in_EX_stage.decoded_info.alu_result;
-                        forwarded = true;
-                        printf("Cycle %d: ID - Forwarding R%d value %d from EX\n",
-                               current_cycle, decoded->R1_idx, decoded->val_R1_source);
-                    } else if (active_in_MEM_stage.valid &&
-                               active_in_MEM_stage.decoded_info.R1_idx == decoded->R1_idx &&
-                               active_in_MEM_stage.decoded_info.opcode != OPCODE_BNE &&
-                               active_in_MEM_stage.decoded_info.opcode != OPCODE_J &&
-                               active_in_MEM_stage.decoded_info.opcode != OPCODE_SW) {
-                        decoded->val_R1_source = (active_in_MEM_stage.decoded_info.opcode == OPCODE_LW) ?
-                                                 active_in_MEM_stage.decoded_info.mem_read_val :
-                                                 active_in_MEM_stage.decoded_info.alu_result;
-                        forwarded = true;
-                        printf("Cycle %d: ID - Forwarding R%d value %d from MEM\n",
-                               current_cycle, decoded->R1_idx, decoded->val_R1_source);
-                    } else if (active_in_WB_stage.valid &&
-                               active_in_WB_stage.decoded_info.R1_idx == decoded->R1_idx &&
-                               active_in_WB_stage.decoded_info.opcode != OPCODE_BNE &&
-                               active_in_WB_stage.decoded_info.opcode != OPCODE_J &&
-                               active_in_WB_stage.decoded_info.opcode != OPCODE_SW) {
-                        decoded->val_R1_source = (active_in_WB_stage.decoded_info.opcode == OPCODE_LW) ?
-                                                 active_in_WB_stage.decoded_info.mem_read_val :
-                                                 active_in_WB_stage.decoded_info.alu_result;
-                        forwarded = true;
-                        printf("Cycle %d: ID - Forwarding R%d value %d from WB\n",
-                               current_cycle, decoded->R1_idx, decoded->val_R1_source);
-                    }
-                    if (!forwarded) {
-                        decoded->val_R1_source = registers[decoded->R1_idx];
-                    }
+                if (decoded->opcode == OPCODE_BNE || decoded->opcode == OPCODE_SW) {
+                    decoded->val_R1_source = read_forwarded_register(decoded->R1_idx);
                 }
                 // Forwarding for R2
-                decoded->val_R2_source = 0;
-                if (decoded->R2_idx != 0) {
-                    bool forwarded = false;
-                    if (active_in_EX_stage.valid && active_in_EX_stage.cycles_spent_in_stage == 2 &&
-                        active_in_EX_stage.decoded_info.R1_idx == decoded->R2_idx &&
-                        active_in_EX_stage.decoded_info.opcode != OPCODE_BNE &&
-                        active_in_EX_stage.decoded_info.opcode != OPCODE_J &&
-                        active_in_EX_stage.decoded_info.opcode != OPCODE_SW) {
-                        decoded->val_R2_source = active_in_EX_stage.decoded_info.alu_result;
-                        forwarded = true;
-                        printf("Cycle %d: ID - Forwarding R%d value %d from EX\n",
-                               current_cycle, decoded->R2_idx, decoded->val_R2_source);
-                    } else if (active_in_MEM_stage.valid &&
-                               active_in_MEM_stage.decoded_info.R1_idx == decoded->R2_idx &&
-                               active_in_MEM_stage.decoded_info.opcode != OPCODE_BNE &&
-                               active_in_MEM_stage.decoded_info.opcode != OPCODE_J &&
-                               active_in_MEM_stage.decoded_info.opcode != OPCODE_SW) {
-                        decoded->val_R2_source = (active_in_MEM_stage.decoded_info.opcode == OPCODE_LW) ?
-                                                 active_in_MEM_stage.decoded_info.mem_read_val :
-                                                 active_in_MEM_stage.decoded_info.alu_result;
-                        forwarded = true;
-                        printf("Cycle %d: ID - Forwarding R%d value %d from MEM\n",
-                               current_cycle, decoded->R2_idx, decoded->val_R2_source);
-                    } else if (active_in_WB_stage.valid &&
-                               active_in_WB_stage.decoded_info.R1_idx == decoded->R2_idx &&
-                               active_in_WB_stage.decoded_info.opcode != OPCODE_BNE &&
-                               active_in_WB_stage.decoded_info.opcode != OPCODE_J &&
-                               active_in_WB_stage.decoded_info.opcode != OPCODE_SW) {
-                        decoded->val_R2_source = (active_in_WB_stage.decoded_info.opcode == OPCODE_LW) ?
-                                                 active_in_WB_stage.decoded_info.mem_read_val :
-                                                 active_in_WB_stage.decoded_info.alu_result;
-                        forwarded = true;
-                        printf("Cycle %d: ID - Forwarding R%d value %d from WB\n",
-                               current_cycle, decoded->R2_idx, decoded->val_R2_source);
-                    }
-                    if (!forwarded) {
-                        decoded->val_R2_source = registers[decoded->R2_idx];
-                    }
-                }
+                decoded->val_R2_source = read_forwarded_register(decoded->R2_idx);
                 break;
 
             case OPCODE_J:
                 decoded->type = 'J';
                 decoded->address = raw_instr & 0x0FFFFFFF;
                 break;
+            case OPCODE_VMEM: case OPCODE_VALU: case OPCODE_VSUM:
+                // Vector registers are read later (EX/MEM, see vector_source),
+                // so only the scalar base of VLD/VST goes through forwarding
+                // here.
+                decoded->type = 'V';
+                decoded->R1_idx = decoded->R2_idx = decoded->R3_idx = 0;
+                decoded->V1_idx = (raw_instr >> 23) & (NUM_VECTOR_REGISTERS - 1);
+                decoded->V2_idx = (raw_instr >> 18) & (NUM_VECTOR_REGISTERS - 1);
+                decoded->V3_idx = (raw_instr >> 13) & (NUM_VECTOR_REGISTERS - 1);
+                decoded->val_R1_source = decoded->val_R2_source = decoded->val_R3_source = 0;
+                decoded->immediate = 0;
+                if (decoded->opcode == OPCODE_VMEM) {
+                    decoded->vector_funct = (raw_instr & VMEM_STORE_BIT) != 0;
+                    decoded->R2_idx = (raw_instr >> 18) & 0x1F;
+                    int32_t offset = raw_instr & 0x1FFFF;
+                    if (offset & (1 << 16)) {
+                        offset |= ~0x1FFFF;
+                    }
+                    decoded->immediate = offset;
+                    decoded->val_R2_source = read_forwarded_register(decoded->R2_idx);
+                } else if (decoded->opcode == OPCODE_VALU) {
+                    decoded->vector_funct = (raw_instr & VALU_SUB_BIT) != 0;
+                } else {
+                    decoded->vector_funct = false;
+                    decoded->R1_idx = (raw_instr >> 23) & 0x1F;
+                }
+                break;
             case OPCODE_NOP:
                 decoded->type = 'N';
                 break;
             default:
-                printf("Cycle %d: ID - Instr %d - Unknown opcode 0x%X. Treating as NOP.\n",
+                tracef("Cycle %d: ID - Instr %d - Unknown opcode 0x%X. Treating as NOP.\n",
                        current_cycle, decoded->original_pc, decoded->opcode);
                 decoded->type = 'N';
                 decoded->opcode = OPCODE_NOP;
                 active_in_ID_stage.raw_instruction = (OPCODE_NOP << 28);
                 break;
         }
-        printf("Cycle %d: ID - Instr %d (%s) decoded (2nd cycle).\n", current_cycle, decoded->original_pc, get_opcode_name(decoded->opcode));
-        printf("Cycle %d: ID - Outputs: Type=%c, R1_idx=%u, R2_idx=%u, R3_idx=%u, R1_val=%d, R2_val=%d, R3_val=%d, Imm=%d, Addr=%u, Shamt=%u\n",
+        tracef("Cycle %d: ID - Instr %d (%s) decoded (2nd cycle).\n", current_cycle, decoded->original_pc, get_opcode_name(decoded->opcode));
+        tracef("Cycle %d: ID - Outputs: Type=%c, R1_idx=%u, R2_idx=%u, R3_idx=%u, R1_val=%d, R2_val=%d, R3_val=%d, Imm=%d, Addr=%u, Shamt=%u\n",
                current_cycle, decoded->type, decoded->R1_idx, decoded->R2_idx, decoded->R3_idx,
                decoded->val_R1_source, decoded->val_R2_source, decoded->val_R3_source, decoded->immediate, decoded->address, decoded->shamt);
     }
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////// vector unit ///////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Host kernels behind VADD/VSUB/VSUM and VLD/VST. The loops are kept free of
+// aliasing and per-element branches so the compiler maps them onto the host's
+// SIMD units.
+void vector_add_kernel(int32_t* restrict out, const int32_t* a, const int32_t* b, int n) {
+    for (int i = 0; i < n; i++) out[i] = a[i] + b[i];
+}
+
+void vector_sub_kernel(int32_t* restrict out, const int32_t* a, const int32_t* b, int n) {
+    for (int i = 0; i < n; i++) out[i] = a[i] - b[i];
+}
+
+int32_t vector_sum_kernel(const int32_t* v, int n) {
+    int32_t sum = 0;
+    for (int i = 0; i < n; i++) sum += v[i];
+    return sum;
+}
+
+bool writes_vector_register(const PipelineRegister* stage, uint32_t v_idx) {
+    return stage->valid && stage->decoded_info.V1_idx == v_idx &&
+           (stage->decoded_info.opcode == OPCODE_VALU ||
+            (stage->decoded_info.opcode == OPCODE_VMEM && !stage->decoded_info.vector_funct));
+}
+
+// Newest value of a vector register for an instruction finishing EX. An older
+// VLD/VADD/VSUB still in flight in EX or sitting in MEM has not written back
+// yet, so its data is forwarded; NULL while that result is not there yet (a
+// VLD waiting for memory, a VADD/VSUB still in a pipelined unit).
+const int32_t* vector_source(uint32_t v_idx) {
+    for (int i = ex_in_flight_count - 1; i >= 0; i--) {
+        const PipelineRegister* older = &ex_in_flight[i];
+        if (!writes_vector_register(older, v_idx)) continue;
+        if (older->decoded_info.opcode == OPCODE_VMEM || !ex_result_ready(older)) return NULL;
+        return older->decoded_info.vector_data;
+    }
+    const PipelineRegister* mem = &active_in_MEM_stage;
+    if (writes_vector_register(mem, v_idx)) {
+        if (mem->decoded_info.opcode == OPCODE_VMEM && !mem_access_done(mem)) return NULL;
+        return mem->decoded_info.vector_data;
+    }
+    return vector_registers[v_idx];
+}
+
+// VLD/VST over data memory starting at decoded->alu_result. A vector that lies
+// wholly inside the data region is moved as one block (it spans at most two
+// dirty pages); otherwise, or when data memory is shared between cores, it
+// goes element by element with out-of-range elements read as 0 / dropped.
+void vector_memory_access(DecodedInstruction* decoded) {
+    int32_t base = decoded->alu_result;
+    int n = pipeline_config.vector_length;
+    bool in_range = base >= DATA_MEM_START && base <= MEMORY_SIZE - n;
+
+    if (decoded->vector_funct) {
+        const int32_t* src = vector_registers[decoded->V1_idx];
+        if (in_range && !multicore_enabled) {
+            memcpy(&memory[base], src, n * sizeof(int32_t));
+            mark_page_dirty(base);
+            mark_page_dirty(base + n - 1);
+        } else {
+            for (int i = 0; i < n; i++) {
+                int32_t address = base + i;
+                if (address >= DATA_MEM_START && address < MEMORY_SIZE) data_memory_write(address, src[i]);
+            }
+        }
+    } else {
+        int32_t* dst = decoded->vector_data;
+        if (in_range && !multicore_enabled) {
+            memcpy(dst, &memory[base], n * sizeof(int32_t));
+        } else {
+            for (int i = 0; i < n; i++) {
+                int32_t address = base + i;
+                dst[i] = (address >= DATA_MEM_START && address < MEMORY_SIZE) ? (int32_t)data_memory_read(address) : 0;
+            }
+        }
+    }
+    if (!in_range) {
+        tracef("Cycle %d: MEM - Instr %d (%s) - Warning! Vector at %d..%d leaves data memory; out-of-range elements %s.\n",
+               current_cycle, decoded->original_pc, decoded->vector_funct ? "VST" : "VLD", base, base + n - 1,
+               decoded->vector_funct ? "ignored" : "read as 0");
+    }
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////// execute /////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void execute_instruction_stage_op() {
+    for (int i = 0; i < ex_in_flight_count; i++) ex_in_flight[i].cycles_spent_in_stage++;
     if (!active_in_EX_stage.valid) return;
     if (active_in_EX_stage.decoded_info.type == 'N') {
         active_in_EX_stage.cycles_spent_in_stage++;
@@ -562,14 +1585,37 @@ void execute_instruction_stage_op() {
     int32_t pc_of_current_instruction = decoded->original_pc;
 
     if (active_in_EX_stage.cycles_spent_in_stage == 1) {
-        printf("Cycle %d: EX - Inputs: Type=%c, R1_val=%d, R2_val=%d, R3_val=%d, Imm=%d, Addr=%u, Shamt=%u\n",
+        tracef("Cycle %d: EX - Inputs: Type=%c, R1_val=%d, R2_val=%d, R3_val=%d, Imm=%d, Addr=%u, Shamt=%u\n",
                current_cycle, decoded->type, decoded->val_R1_source, decoded->val_R2_source, decoded->val_R3_source,
                decoded->immediate, decoded->address, decoded->shamt);
-        printf("Cycle %d: EX - Instr %d (%s) entered EX (1st cycle).\n",
+        tracef("Cycle %d: EX - Instr %d (%s) entered EX (1st cycle).\n",
                current_cycle, decoded->original_pc, get_opcode_name(decoded->opcode));
-        printf("Cycle %d: EX - Outputs: None (1st cycle)\n", current_cycle);
-    } else if (active_in_EX_stage.cycles_spent_in_stage == 2) {
+        if (ex_occupancy_of(decoded->opcode) > 1) tracef("Cycle %d: EX - Outputs: None (1st cycle)\n", current_cycle);
+    }
+    // A pipelined unit computes on issue; ex_result_ready() hides the value
+    // until the full latency has passed.
+    if (active_in_EX_stage.cycles_spent_in_stage == ex_occupancy_of(decoded->opcode)) {
         branch_taken_in_EX_cycle2 = false;
+        const int32_t* va = NULL;
+        const int32_t* vb = NULL;
+        if (decoded->opcode == OPCODE_VALU || decoded->opcode == OPCODE_VSUM) {
+            va = vector_source(decoded->V2_idx);
+            vb = decoded->opcode == OPCODE_VALU ? vector_source(decoded->V3_idx) : va;
+            if (va == NULL || vb == NULL) {
+                active_in_EX_stage.cycles_spent_in_stage--; // Retry once the VLD has read memory
+                tracef("Cycle %d: EX - Instr %d (%s) waiting for a vector load in MEM.\n",
+                       current_cycle, decoded->original_pc, get_opcode_name(decoded->opcode));
+                return;
+            }
+        }
+        if (decoded->fused_R1_idx != 0) {
+            // The fused ADDI runs first; its result replaces the second
+            // instruction's reads of that register.
+            decoded->fused_result = decoded->fused_source + decoded->fused_immediate;
+            if (decoded->opcode != OPCODE_LW && decoded->R1_idx == decoded->fused_R1_idx) decoded->val_R1_source = decoded->fused_result;
+            if (decoded->R2_idx == decoded->fused_R1_idx) decoded->val_R2_source = decoded->fused_result;
+            tracef("Cycle %d: EX - Fused ADDI: R%u = %d\n", current_cycle, decoded->fused_R1_idx, decoded->fused_result);
+        }
         switch (decoded->opcode) {
             case OPCODE_ADD:  decoded->alu_result = decoded->val_R2_source + decoded->val_R3_source; break;
             case OPCODE_SUB:  decoded->alu_result = decoded->val_R2_source - decoded->val_R3_source; break;
@@ -597,10 +1643,20 @@ void execute_instruction_stage_op() {
             case OPCODE_SRL:  decoded->alu_result = (int32_t)((uint32_t)decoded->val_R2_source >> decoded->shamt); break;
             case OPCODE_LW:
             case OPCODE_SW:   decoded->alu_result = decoded->val_R2_source + decoded->immediate; break;
+            case OPCODE_VMEM: decoded->alu_result = decoded->val_R2_source + decoded->immediate; break;
+            case OPCODE_VALU:
+                if (decoded->vector_funct) {
+                    vector_sub_kernel(decoded->vector_data, va, vb, pipeline_config.vector_length);
+                } else {
+                    vector_add_kernel(decoded->vector_data, va, vb, pipeline_config.vector_length);
+                }
+                decoded->alu_result = 0;
+                break;
+            case OPCODE_VSUM: decoded->alu_result = vector_sum_kernel(va, pipeline_config.vector_length); break;
             default: decoded->alu_result = 0; break;
         }
-        printf("Cycle %d: EX - Instr %d (%s) executed (2nd cycle).\n", current_cycle, decoded->original_pc, get_opcode_name(decoded->opcode));
-        printf("Cycle %d: EX - Outputs: ALU/Addr=%d, BranchTaken=%s\n",
+        tracef("Cycle %d: EX - Instr %d (%s) executed (2nd cycle).\n", current_cycle, decoded->original_pc, get_opcode_name(decoded->opcode));
+        tracef("Cycle %d: EX - Outputs: ALU/Addr=%d, BranchTaken=%s\n",
                current_cycle, decoded->alu_result, branch_taken_in_EX_cycle2 ? "YES" : "NO");
     }
 }
@@ -608,9 +1664,113 @@ void execute_instruction_stage_op() {
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////// mem ///////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// --- Store buffer ---
+// With --pipeline store_buffer=N a SW to data memory takes an entry instead of
+// the memory port and leaves MEM in its first cycle, whether or not MEM owns
+// the port then. A LW whose address is buffered takes the newest matching
+// value the same way. The head entry is written back in any port cycle that
+// neither MEM nor IF uses (each write takes mem_latency of them). VLD/VST
+// touch a whole range and act as fences: they wait in MEM until the buffer is
+// empty. The halt check waits for it too, and a cycle-limit halt writes the
+// remaining entries out at once.
+
+const StoreBufferEntry* store_buffer_lookup(int32_t address) {
+    for (int i = store_buffer_count - 1; i >= 0; i--) {
+        if (store_buffer[i].address == address) return &store_buffer[i];
+    }
+    return NULL;
+}
+
+void pop_store_buffer() {
+    data_memory_write(store_buffer[0].address, store_buffer[0].value);
+    store_buffer_count--;
+    memmove(&store_buffer[0], &store_buffer[1], store_buffer_count * sizeof(StoreBufferEntry));
+}
+
+// Handles the instruction in MEM if the store buffer decides its cycle: a SW
+// that gets (or waits for) an entry, a LW served from the buffer, a VLD/VST
+// waiting for it to drain. Returns false if MEM goes through the port as usual.
+bool store_buffer_access() {
+    DecodedInstruction* decoded = &active_in_MEM_stage.decoded_info;
+    int32_t address = decoded->alu_result;
+    int latency = mem_latency_of(decoded->opcode);
+    if (decoded->opcode == OPCODE_SW && address >= DATA_MEM_START && address < MEMORY_SIZE) {
+        if (store_buffer_count == pipeline_config.store_buffer_depth) {
+            store_buffer_stats.full_cycles++;
+            tracef("Cycle %d: MEM - Instr %d (SW) waiting: store buffer full (%d entries).\n",
+                   current_cycle, decoded->original_pc, store_buffer_count);
+            return true;
+        }
+        store_buffer[store_buffer_count++] = (StoreBufferEntry){address, (uint32_t)decoded->val_R1_source, 0};
+        store_buffer_stats.buffered++;
+        active_in_MEM_stage.cycles_spent_in_stage = latency;
+        mem_port_bypassed = true;
+        tracef("Cycle %d: MEM - Instr %d (SW) to Addr %d buffered. Value: %d (from R%d), %d of %d entries used\n",
+               current_cycle, decoded->original_pc, address, decoded->val_R1_source, decoded->R1_idx,
+               store_buffer_count, pipeline_config.store_buffer_depth);
+        return true;
+    }
+    if (decoded->opcode == OPCODE_LW && active_in_MEM_stage.cycles_spent_in_stage == 0) {
+        const StoreBufferEntry* entry = store_buffer_lookup(address);
+        if (entry == NULL) return false;
+        decoded->mem_read_val = (int32_t)entry->value;
+        store_buffer_stats.forwarded++;
+        active_in_MEM_stage.cycles_spent_in_stage = latency;
+        mem_port_bypassed = true;
+        tracef("Cycle %d: MEM - Instr %d (LW) from Addr %d forwarded by the store buffer. Read val: %d\n",
+               current_cycle, decoded->original_pc, address, decoded->mem_read_val);
+        return true;
+    }
+    if (decoded->opcode == OPCODE_VMEM && store_buffer_count > 0 && active_in_MEM_stage.cycles_spent_in_stage == 0) {
+        store_buffer_stats.fence_cycles++;
+        tracef("Cycle %d: MEM - Instr %d (%s) waiting for the store buffer to drain (%d entries).\n",
+               current_cycle, decoded->original_pc, decoded->vector_funct ? "VST" : "VLD", store_buffer_count);
+        return true;
+    }
+    return false;
+}
+
+// Gives the memory port to the head entry if nothing else used it this cycle.
+// Called once IF has decided whether it fetches.
+void drain_store_buffer() {
+    if (store_buffer_count == 0) return;
+    if (!store_buffer_may_drain(mem_port_used, fetched_pc_this_cycle >= 0, can_MEM_operate_this_cycle)) {
+        if (mem_port_used || !pipeline_config.split_memory_ports) store_buffer_stats.port_yielded++;
+        return;
+    }
+    if (++store_buffer[0].cycles < pipeline_config.mem_latency) return;
+    tracef("Cycle %d: MEM - Store buffer wrote %d to Addr %d in an idle port cycle.\n",
+           current_cycle, (int32_t)store_buffer[0].value, store_buffer[0].address);
+    tracef("Cycle %d: MEM - Memory[0x%04X] changed to %d from the store buffer\n",
+           current_cycle, store_buffer[0].address, (int32_t)store_buffer[0].value);
+    store_buffer_stats.drained++;
+    pop_store_buffer();
+}
+
+// Halt by cycle limit: whatever is still buffered reaches memory now.
+void flush_store_buffer() {
+    if (store_buffer_count > 0) {
+        tracef("Cycle %d: MEM - Store buffer flushed at halt (%d entries).\n", current_cycle, store_buffer_count);
+    }
+    while (store_buffer_count > 0) pop_store_buffer();
+}
+
+void print_store_buffer_report() {
+    printf("Store buffer (%d entries): %ld stores buffered, %ld loads forwarded, %ld written in idle port cycles\n",
+           pipeline_config.store_buffer_depth, store_buffer_stats.buffered, store_buffer_stats.forwarded,
+           store_buffer_stats.drained);
+    printf("  %ld cycles a buffered store gave the port to IF or a load; %ld cycles stalled on a full buffer, %ld on VLD/VST fences\n",
+           store_buffer_stats.port_yielded, store_buffer_stats.full_cycles, store_buffer_stats.fence_cycles);
+}
+
 void memory_access_stage_op() {
+    if (pipeline_config.store_buffer_depth > 0 && active_in_MEM_stage.valid &&
+        active_in_MEM_stage.decoded_info.type != 'N' && store_buffer_access()) {
+        return;
+    }
     if (!can_MEM_operate_this_cycle) {
-        printf("Cycle %d: MEM - Idle (IF active or waiting for branch resolution).\n", current_cycle);
+        tracef("Cycle %d: MEM - Idle (IF active or waiting for branch resolution).\n", current_cycle);
         return;
     }
     if (!active_in_MEM_stage.valid) return;
@@ -618,41 +1778,66 @@ void memory_access_stage_op() {
         return;
     }
 
-    active_in_MEM_stage.cycles_spent_in_stage = 1;
+    active_in_MEM_stage.cycles_spent_in_stage++;
     DecodedInstruction* decoded = &active_in_MEM_stage.decoded_info;
+    mem_port_used = decoded->opcode == OPCODE_LW || decoded->opcode == OPCODE_SW || decoded->opcode == OPCODE_VMEM;
     int32_t effective_address = decoded->alu_result;
+    int latency = mem_latency_of(decoded->opcode);
+    if (active_in_MEM_stage.cycles_spent_in_stage < latency) {
+        tracef("Cycle %d: MEM - Instr %d (%s) accessing Addr %d (cycle %d of %d).\n", current_cycle,
+               decoded->original_pc, get_opcode_name(decoded->opcode), effective_address,
+               active_in_MEM_stage.cycles_spent_in_stage, latency);
+        return;
+    }
 
-    printf("Cycle %d: MEM - Inputs: ALU/Addr=%d, R1_val=%d\n", current_cycle, effective_address, decoded->val_R1_source);
+    tracef("Cycle %d: MEM - Inputs: ALU/Addr=%d, R1_val=%d\n", current_cycle, effective_address, decoded->val_R1_source);
     switch (decoded->opcode) {
         case OPCODE_LW:
             if (effective_address >= DATA_MEM_START && effective_address < MEMORY_SIZE) {
-                decoded->mem_read_val = memory[effective_address];
-                printf("Cycle %d: MEM - Instr %d (LW) from Addr %d. Read val: %d\n",
+                decoded->mem_read_val = data_memory_read(effective_address);
+                tracef("Cycle %d: MEM - Instr %d (LW) from Addr %d. Read val: %d\n",
+                       current_cycle, decoded->original_pc, effective_address, decoded->mem_read_val);
+                tracef("Cycle %d: MEM - Outputs: MemReadVal=%d\n", current_cycle, decoded->mem_read_val);
+            } else if (is_io_port(effective_address)) {
+                decoded->mem_read_val = io_port_read(effective_address);
+                tracef("Cycle %d: MEM - Instr %d (LW) from I/O port %d. Read val: %d\n",
                        current_cycle, decoded->original_pc, effective_address, decoded->mem_read_val);
-                printf("Cycle %d: MEM - Outputs: MemReadVal=%d\n", current_cycle, decoded->mem_read_val);
+                tracef("Cycle %d: MEM - Outputs: MemReadVal=%d\n", current_cycle, decoded->mem_read_val);
             } else {
-                printf("Cycle %d: MEM - Instr %d (LW) - Error! Invalid mem read addr: %d. Reading 0.\n",
+                tracef("Cycle %d: MEM - Instr %d (LW) - Error! Invalid mem read addr: %d. Reading 0.\n",
                        current_cycle, decoded->original_pc, effective_address);
-                printf("Cycle %d: MEM - Outputs: MemReadVal=0\n", current_cycle);
+                tracef("Cycle %d: MEM - Outputs: MemReadVal=0\n", current_cycle);
                 decoded->mem_read_val = 0;
             }
             break;
         case OPCODE_SW:
             if (effective_address >= DATA_MEM_START && effective_address < MEMORY_SIZE) {
-                memory[effective_address] = decoded->val_R1_source;
-                printf("Cycle %d: MEM - Instr %d (SW) to Addr %d. Wrote val: %d (from R%d)\n",
+                data_memory_write(effective_address, decoded->val_R1_source);
+                tracef("Cycle %d: MEM - Instr %d (SW) to Addr %d. Wrote val: %d (from R%d)\n",
                        current_cycle, decoded->original_pc, effective_address, decoded->val_R1_source, decoded->R1_idx);
-                printf("Cycle %d: MEM - Memory[0x%04X] changed to %d in MEM stage\n",
+                tracef("Cycle %d: MEM - Memory[0x%04X] changed to %d in MEM stage\n",
                        current_cycle, effective_address, decoded->val_R1_source);
-                printf("Cycle %d: MEM - Outputs: None (write completed)\n", current_cycle);
+                tracef("Cycle %d: MEM - Outputs: None (write completed)\n", current_cycle);
+            } else if (is_io_port(effective_address)) {
+                io_port_write(effective_address, decoded->val_R1_source);
+                tracef("Cycle %d: MEM - Instr %d (SW) to I/O port %d. Wrote val: %d (from R%d)\n",
+                       current_cycle, decoded->original_pc, effective_address, decoded->val_R1_source, decoded->R1_idx);
+                tracef("Cycle %d: MEM - Outputs: None (write completed)\n", current_cycle);
             } else {
-                printf("Cycle %d: MEM - Instr %d (SW) - Error! Invalid mem write addr: %d. Write ignored.\n",
+                tracef("Cycle %d: MEM - Instr %d (SW) - Error! Invalid mem write addr: %d. Write ignored.\n",
                        current_cycle, decoded->original_pc, effective_address);
-                printf("Cycle %d: MEM - Outputs: None (write ignored)\n", current_cycle);
+                tracef("Cycle %d: MEM - Outputs: None (write ignored)\n", current_cycle);
             }
             break;
+        case OPCODE_VMEM:
+            vector_memory_access(decoded);
+            tracef("Cycle %d: MEM - Instr %d (%s) V%u %s Addr %d..%d (%d elements)\n",
+                   current_cycle, decoded->original_pc, decoded->vector_funct ? "VST" : "VLD", decoded->V1_idx,
+                   decoded->vector_funct ? "to" : "from", effective_address,
+                   effective_address + pipeline_config.vector_length - 1, pipeline_config.vector_length);
+            break;
         default:
-            printf("Cycle %d: MEM - Outputs: None (no memory operation)\n", current_cycle);
+            tracef("Cycle %d: MEM - Outputs: None (no memory operation)\n", current_cycle);
             break;
     }
 }
@@ -663,16 +1848,25 @@ void memory_access_stage_op() {
 
 void write_back_stage_op() {
     if (!active_in_WB_stage.valid) return;
+    instructions_retired++;
     if (active_in_WB_stage.decoded_info.type == 'N') {
         return;
     }
+    if (active_in_WB_stage.fusion != FUSION_NONE) {
+        // The fused ADDI retires first (fusion needs its destination != R0)
+        instructions_retired++;
+        fused_pairs_retired[active_in_WB_stage.fusion]++;
+        registers[active_in_WB_stage.decoded_info.fused_R1_idx] = active_in_WB_stage.decoded_info.fused_result;
+        tracef("Cycle %d: WB - Instr %d (ADDI) wrote %d to R%d.\n", current_cycle, active_in_WB_stage.instruction_pc_at_fetch,
+               active_in_WB_stage.decoded_info.fused_result, active_in_WB_stage.decoded_info.fused_R1_idx);
+    }
 
     active_in_WB_stage.cycles_spent_in_stage = 1;
     DecodedInstruction* decoded = &active_in_WB_stage.decoded_info;
     int32_t result_to_write = 0;
     bool perform_write = false;
 
-    printf("Cycle %d: WB - Inputs: ALUResult=%d, MemReadVal=%d\n",
+    tracef("Cycle %d: WB - Inputs: ALUResult=%d, MemReadVal=%d\n",
            current_cycle, decoded->alu_result, decoded->mem_read_val);
     switch (decoded->opcode) {
         case OPCODE_ADD: case OPCODE_SUB: case OPCODE_SLL: case OPCODE_SRL:
@@ -684,11 +1878,23 @@ void write_back_stage_op() {
             result_to_write = decoded->mem_read_val;
             perform_write = true;
             break;
+        case OPCODE_VSUM:
+            result_to_write = decoded->alu_result;
+            perform_write = true;
+            break;
+        case OPCODE_VMEM: case OPCODE_VALU:
+            if (decoded->opcode == OPCODE_VALU || !decoded->vector_funct) {
+                memcpy(vector_registers[decoded->V1_idx], decoded->vector_data, pipeline_config.vector_length * sizeof(int32_t));
+                tracef("Cycle %d: WB - Instr %d (%s) wrote %d elements to V%u.\n",
+                       current_cycle, decoded->original_pc, get_opcode_name(decoded->opcode), pipeline_config.vector_length, decoded->V1_idx);
+            }
+            perform_write = false;
+            break;
         case OPCODE_BNE: case OPCODE_J: case OPCODE_SW: case OPCODE_NOP:
             perform_write = false;
             break;
         default:
-            printf("Cycle %d: WB - Instr %d (%s) - Error! Unknown opcode %u in WB. No write.\n",
+            tracef("Cycle %d: WB - Instr %d (%s) - Error! Unknown opcode %u in WB. No write.\n",
                    current_cycle, decoded->original_pc, get_opcode_name(decoded->opcode), decoded->opcode);
             perform_write = false;
             break;
@@ -697,90 +1903,359 @@ void write_back_stage_op() {
     if (perform_write) {
         if (decoded->R1_idx != 0) {
             registers[decoded->R1_idx] = result_to_write;
-            printf("Cycle %d: WB - Instr %d (%s) wrote %d to R%d.\n",
+            tracef("Cycle %d: WB - Instr %d (%s) wrote %d to R%d.\n",
                    current_cycle, decoded->original_pc, get_opcode_name(decoded->opcode), result_to_write, decoded->R1_idx);
-            printf("Cycle %d: WB - Register R%d changed to %d in WB stage\n",
+            tracef("Cycle %d: WB - Register R%d changed to %d in WB stage\n",
                    current_cycle, decoded->R1_idx, result_to_write);
         } else {
-            printf("Cycle %d: WB - Instr %d (%s) - Attempted write to R0 with value %d. Suppressed.\n",
+            tracef("Cycle %d: WB - Instr %d (%s) - Attempted write to R0 with value %d. Suppressed.\n",
                    current_cycle, decoded->original_pc, get_opcode_name(decoded->opcode), result_to_write);
-            printf("Cycle %d: WB - Register R0 change to %d suppressed in WB stage\n",
+            tracef("Cycle %d: WB - Register R0 change to %d suppressed in WB stage\n",
                    current_cycle, result_to_write);
         }
-        printf("Cycle %d: WB - Outputs: R%d=%d\n", current_cycle, decoded->R1_idx, result_to_write);
+        tracef("Cycle %d: WB - Outputs: R%d=%d\n", current_cycle, decoded->R1_idx, result_to_write);
     } else {
-        printf("Cycle %d: WB - Outputs: None (no write-back)\n", current_cycle);
+        tracef("Cycle %d: WB - Outputs: None (no write-back)\n", current_cycle);
     }
     registers[0] = 0;
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////// profiler ////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Every cycle is charged to one instruction: the oldest one that has not
+// finished EX (in flight in a pipelined unit, EX, then ID, then the one IF
+// just fetched). While EX is empty
+// the cycle goes to the instruction held in ID by a load-use stall, to the
+// taken branch whose refill is in progress, or to the next PC if IF lost the
+// shared port to MEM.
+#define PROFILE_EXECUTE      0
+#define PROFILE_LOAD_USE     1
+#define PROFILE_BRANCH_FLUSH 2
+#define PROFILE_PORT_WAIT    3
+#define NUM_PROFILE_CATEGORIES 4
+#define PROFILE_TOP_BLOCKS   10
+
+_Thread_local bool profiling_enabled = false;
+_Thread_local long profile_cycles[INSTRUCTION_MEM_END + 1][NUM_PROFILE_CATEGORIES];
+_Thread_local long profile_retired[INSTRUCTION_MEM_END + 1];
+_Thread_local long profile_unattributed = 0; // Start-up/drain cycles with nothing in flight
+
+void profile_charge(int pc, int category) {
+    if (pc >= 0 && pc <= INSTRUCTION_MEM_END) profile_cycles[pc][category]++;
+    else profile_unattributed++;
+}
+
+// Sampled in simulate_clock_cycle after all stages ran, before latching.
+void profile_cycle() {
+    if (active_in_WB_stage.valid) {
+        int pc = active_in_WB_stage.instruction_pc_at_fetch;
+        if (pc >= 0 && pc <= INSTRUCTION_MEM_END) profile_retired[pc]++;
+        if (active_in_WB_stage.fusion != FUSION_NONE && pc + 1 <= INSTRUCTION_MEM_END) profile_retired[pc + 1]++;
+    }
+    // The refill after a taken branch ends when a new instruction enters EX.
+    if (active_in_EX_stage.valid && active_in_EX_stage.cycles_spent_in_stage == 1) flush_branch_pc = -1;
+
+    if (ex_in_flight_count > 0) {
+        profile_charge(ex_in_flight[0].instruction_pc_at_fetch, PROFILE_EXECUTE);
+    } else if (active_in_EX_stage.valid) {
+        profile_charge(active_in_EX_stage.instruction_pc_at_fetch, PROFILE_EXECUTE);
+    } else if (active_in_ID_stage.valid && active_in_ID_stage.instruction_pc_at_fetch == load_use_stall_pc) {
+        profile_charge(load_use_stall_pc, PROFILE_LOAD_USE);
+    } else if (flush_branch_pc >= 0) {
+        profile_charge(flush_branch_pc, PROFILE_BRANCH_FLUSH);
+    } else if (active_in_ID_stage.valid) {
+        profile_charge(active_in_ID_stage.instruction_pc_at_fetch, PROFILE_EXECUTE);
+    } else if (fetched_pc_this_cycle >= 0) {
+        profile_charge(fetched_pc_this_cycle, PROFILE_EXECUTE);
+    } else if (!can_IF_operate_this_cycle && PC < instructions_loaded_count) {
+        profile_charge(PC, PROFILE_PORT_WAIT);
+    } else {
+        profile_unattributed++;
+    }
+
+    // The stalled instruction stops being charged as load-use once it leaves ID.
+    if (active_in_ID_stage.valid && active_in_ID_stage.cycles_spent_in_stage == pipeline_config.id_latency && !hazard_detected &&
+        active_in_ID_stage.instruction_pc_at_fetch == load_use_stall_pc) {
+        load_use_stall_pc = -1;
+    }
+}
+
+// Renders an instruction word in the syntax accepted by load_assembly_file.
+void disassemble_instruction(uint32_t raw, char* buf, size_t size) {
+    uint8_t opcode = (raw >> 28) & 0xF;
+    int r1 = (raw >> 23) & 0x1F, r2 = (raw >> 18) & 0x1F, r3 = (raw >> 13) & 0x1F;
+    int32_t imm = raw & 0x3FFFF;
+    if (imm & (1 << 17)) imm |= ~0x3FFFF;
+    const char* name = get_opcode_name(opcode);
+    switch (opcode) {
+        case OPCODE_ADD: case OPCODE_SUB:
+            snprintf(buf, size, "%s R%d R%d R%d", name, r1, r2, r3); break;
+        case OPCODE_SLL: case OPCODE_SRL:
+            snprintf(buf, size, "%s R%d R%d %u", name, r1, r2, raw & 0x1FFF); break;
+        case OPCODE_LW: case OPCODE_SW:
+            snprintf(buf, size, "%s R%d %d(R%d)", name, r1, imm, r2); break;
+        case OPCODE_MULI: case OPCODE_ADDI: case OPCODE_BNE: case OPCODE_ANDI: case OPCODE_ORI:
+            snprintf(buf, size, "%s R%d R%d %d", name, r1, r2, imm); break;
+        case OPCODE_J:
+            snprintf(buf, size, "%s %u", name, raw & 0x0FFFFFFF); break;
+        case OPCODE_VMEM: {
+            int32_t offset = raw & 0x1FFFF;
+            if (offset & (1 << 16)) offset |= ~0x1FFFF;
+            snprintf(buf, size, "%s V%d %d(R%d)", (raw & VMEM_STORE_BIT) ? "VST" : "VLD", r1 & 7, offset, r2);
+            break;
+        }
+        case OPCODE_VALU:
+            snprintf(buf, size, "%s V%d V%d V%d", (raw & VALU_SUB_BIT) ? "VSUB" : "VADD", r1 & 7, r2 & 7, r3 & 7); break;
+        case OPCODE_VSUM:
+            snprintf(buf, size, "%s R%d V%d", name, r1, r2 & 7); break;
+        default:
+            snprintf(buf, size, "%s", name); break;
+    }
+}
+
+long profile_total(int pc) {
+    long total = 0;
+    for (int c = 0; c < NUM_PROFILE_CATEGORIES; c++) total += profile_cycles[pc][c];
+    return total;
+}
+
+void print_profile_report() {
+    int n = instructions_loaded_count;
+    bool leader[INSTRUCTION_MEM_END + 2] = {false};
+    char text[48];
+    double total = current_cycle > 0 ? current_cycle : 1;
+
+    printf("\n--- Profile: %d cycles, %ld instructions retired, CPI %.2f ---\n",
+           current_cycle, instructions_retired, instructions_retired > 0 ? current_cycle / (double)instructions_retired : 0.0);
+    printf("  PC  %-22s %7s %6s %7s %8s %6s %6s %7s\n", "Instruction", "Cycles", "%", "Execute", "LoadUse", "Flush", "Port", "Retired");
+    for (int pc = 0; pc < n; pc++) {
+        disassemble_instruction(memory[pc], text, sizeof(text));
+        printf("%4d  %-22s %7ld %5.1f%% %7ld %8ld %6ld %6ld %7ld\n", pc, text, profile_total(pc),
+               100.0 * profile_total(pc) / total, profile_cycles[pc][PROFILE_EXECUTE], profile_cycles[pc][PROFILE_LOAD_USE],
+               profile_cycles[pc][PROFILE_BRANCH_FLUSH], profile_cycles[pc][PROFILE_PORT_WAIT], profile_retired[pc]);
+    }
+    printf("Unattributed (start-up/drain): %ld cycles\n", profile_unattributed);
+
+    // Basic blocks: leaders are PC 0, branch/jump targets and fall-throughs.
+    leader[0] = true;
+    for (int pc = 0; pc < n; pc++) {
+        uint8_t opcode = (memory[pc] >> 28) & 0xF;
+        if (opcode != OPCODE_BNE && opcode != OPCODE_J) continue;
+        int32_t imm = memory[pc] & 0x3FFFF;
+        if (imm & (1 << 17)) imm |= ~0x3FFFF;
+        int target = opcode == OPCODE_BNE ? pc + 1 + imm : (int)(memory[pc] & 0x0FFFFFFF);
+        if (target >= 0 && target < n) leader[target] = true;
+        leader[pc + 1] = true;
+    }
+    int block_start[INSTRUCTION_MEM_END + 1];
+    long block_cycles[INSTRUCTION_MEM_END + 1];
+    int num_blocks = 0;
+    for (int pc = 0; pc < n; pc++) {
+        if (leader[pc]) {
+            block_start[num_blocks] = pc;
+            block_cycles[num_blocks++] = 0;
+        }
+        block_cycles[num_blocks - 1] += profile_total(pc);
+    }
+
+    printf("\nHottest basic blocks:\n");
+    for (int rank = 0; rank < PROFILE_TOP_BLOCKS && rank < num_blocks; rank++) {
+        int best = rank;
+        for (int b = rank + 1; b < num_blocks; b++) {
+            if (block_cycles[b] > block_cycles[best]) best = b;
+        }
+        int tmp_start = block_start[rank]; block_start[rank] = block_start[best]; block_start[best] = tmp_start;
+        long tmp_cycles = block_cycles[rank]; block_cycles[rank] = block_cycles[best]; block_cycles[best] = tmp_cycles;
+        if (block_cycles[rank] == 0) break;
+        int end = block_start[rank] + 1;
+        while (end < n && !leader[end]) end++;
+        printf("  #%d  PC %d..%d  %ld cycles (%.1f%%)\n", rank + 1, block_start[rank], end - 1,
+               block_cycles[rank], 100.0 * block_cycles[rank] / total);
+    }
+}
+
+// --- Host self-profile (HOST_PROFILE builds) ---
+// Worker threads merge their thread-local timers into these totals before
+// they exit; print_host_profile merges the main thread's and reports. On Linux
+// perf_event_open adds the host core cycles and instructions of the whole run
+// (including parsing and reporting), where the kernel allows it.
+#ifdef HOST_PROFILE
+pthread_mutex_t host_profile_lock = PTHREAD_MUTEX_INITIALIZER;
+uint64_t host_ticks_total[NUM_HOST_SECTIONS];
+long host_cycles_total = 0;
+int host_perf_cycles_fd = -1;
+int host_perf_instructions_fd = -1;
+
+void host_profile_merge() {
+    pthread_mutex_lock(&host_profile_lock);
+    for (int s = 0; s < NUM_HOST_SECTIONS; s++) host_ticks_total[s] += host_ticks[s];
+    host_cycles_total += host_cycles_stepped;
+    pthread_mutex_unlock(&host_profile_lock);
+    memset(host_ticks, 0, sizeof(host_ticks));
+    host_cycles_stepped = 0;
+}
+
+int open_host_counter(uint64_t config) {
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.inherit = 1; // Count the worker threads started later too
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    (void)config;
+    return -1;
+#endif
+}
+
+long long read_host_counter(int fd) {
+    long long value = 0;
+    if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value)) return -1;
+    return value;
+}
+
+void print_host_profile() {
+    static const char* names[NUM_HOST_SECTIONS] = { "IF", "ID", "EX", "MEM", "WB", "hazards/forwarding",
+                                                    "latching", "trace printf", "cycle control" };
+    host_profile_merge();
+    uint64_t total = 0;
+    for (int s = 0; s < NUM_HOST_SECTIONS; s++) total += host_ticks_total[s];
+    long cycles = host_cycles_total > 0 ? host_cycles_total : 1;
+#if defined(__x86_64__) || defined(__i386__)
+    const char* unit = "TSC ticks";
+#else
+    const char* unit = "ns";
+#endif
+    printf("\n--- Host Profile (%ld simulated cycles stepped, %s per cycle) ---\n", host_cycles_total, unit);
+    for (int s = 0; s < NUM_HOST_SECTIONS; s++) {
+        printf("  %-20s %10.1f  %5.1f%%\n", names[s], (double)host_ticks_total[s] / cycles,
+               total ? 100.0 * host_ticks_total[s] / total : 0.0);
+    }
+    printf("  %-20s %10.1f\n", "total", (double)total / cycles);
+    long long core_cycles = read_host_counter(host_perf_cycles_fd);
+    long long instructions = read_host_counter(host_perf_instructions_fd);
+    if (core_cycles > 0) {
+        printf("  Whole run: %lld host cycles (%.1f per simulated cycle)", core_cycles, (double)core_cycles / cycles);
+        if (instructions > 0) printf(", %lld instructions, IPC %.2f", instructions, (double)instructions / core_cycles);
+        printf("\n");
+    } else {
+        printf("  Whole run: hardware counters unavailable (perf_event_open)\n");
+    }
+}
+
+// Called from main before any worker thread starts.
+void start_host_profile() {
+#ifdef __linux__
+    host_perf_cycles_fd = open_host_counter(PERF_COUNT_HW_CPU_CYCLES);
+    host_perf_instructions_fd = open_host_counter(PERF_COUNT_HW_INSTRUCTIONS);
+#endif
+    atexit(print_host_profile);
+}
+#endif // HOST_PROFILE
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////// simulate process ////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// True while a BNE/J that could still redirect fetch is in ID or EX
+// (BRANCH_STALL only; BRANCH_FLUSH fetches on and flushes instead).
+bool branch_unresolved() {
+    return branch_holds_fetch(active_in_ID_stage.valid && is_branch_opcode((active_in_ID_stage.raw_instruction >> 28) & 0xF),
+                              active_in_EX_stage.valid && is_branch_opcode(active_in_EX_stage.decoded_info.opcode) &&
+                                  !ex_result_ready(&active_in_EX_stage));
+}
+
+// Rough cycles-per-instruction budget of the configuration in quarters (4 for
+// the default pipeline), used to stretch the default safety break.
+int pipeline_cycle_scale() {
+    int ex_latency = pipeline_config.ex_latency;
+    for (int op = 0; op < NUM_OPCODES; op++) {
+        if (pipeline_config.opcode_ex_latency[op] > ex_latency) ex_latency = pipeline_config.opcode_ex_latency[op];
+    }
+    return pipeline_config.id_latency + ex_latency + (pipeline_config.forwarding ? 0 : 4) +
+           (pipeline_config.branch_policy == BRANCH_STALL ? 2 : 0) + 2 * (pipeline_config.mem_latency - 1);
+}
+
 void simulate_clock_cycle() {
+    HOST_TIMER_START(HOST_CONTROL);
     current_cycle++;
-    printf("\n=============== Cycle %3d =============== (PC before fetch: %d)\n", current_cycle, PC);
+    fetched_pc_this_cycle = -1;
+    fetched_pair_this_cycle = false;
+    mem_port_used = false;
+    mem_port_bypassed = false;
+    tracef("\n=============== Cycle %3d =============== (PC before fetch: %d)\n", current_cycle, PC);
 
     // Determine IF/MEM activity
-    can_IF_operate_this_cycle = (current_cycle % 2 != 0); // Odd cycles for IF
-    can_MEM_operate_this_cycle = (current_cycle % 2 == 0); // Even cycles for MEM
+    can_IF_operate_this_cycle = IF_port_cycle(current_cycle);
+    can_MEM_operate_this_cycle = MEM_port_cycle(current_cycle);
 
     if (stall_IF_for_mem_after_branch) {
         can_IF_operate_this_cycle = false;
         stall_IF_for_mem_after_branch = false;
-        printf("Cycle %d: Control - IF stalled due to MEM access by prior branch/jump.\n", current_cycle);
+        tracef("Cycle %d: Control - IF stalled due to MEM access by prior branch/jump.\n", current_cycle);
     }
 
     // Track if branch is taken to suppress IF
     bool suppress_IF_this_cycle = false;
 
     // Print pipeline state at the start of the cycle in the requested format
-    printf("--- Pipeline Stage Contents (Start of Cycle %d) ---\n", current_cycle);
+    tracef("--- Pipeline Stage Contents (Start of Cycle %d) ---\n", current_cycle);
     if (can_IF_operate_this_cycle && PC < MEMORY_SIZE) {
         uint32_t raw_instr = memory[PC];
-        printf("IF (fetch buffer) : Instr PC %2d, Raw 0x%08X, Valid: %s, Opcode: %-4s\n",
+        tracef("IF (fetch buffer) : Instr PC %2d, Raw 0x%08X, Valid: %s, Opcode: %-4s\n",
                PC, raw_instr, "F", "---");
     } else {
-        printf("IF (fetch buffer) : Instr PC %2d, Raw 0x%08X, Valid: %s, Opcode: %-4s\n",
+        tracef("IF (fetch buffer) : Instr PC %2d, Raw 0x%08X, Valid: %s, Opcode: %-4s\n",
                -1, 0, "F", "---");
     }
-    printf("ID                : Instr PC %2d, Raw 0x%08X, Valid: %s, Opcode: %-4s, CycInStg: %d\n",
+    tracef("ID                : Instr PC %2d, Raw 0x%08X, Valid: %s, Opcode: %-4s, CycInStg: %d\n",
            active_in_ID_stage.valid ? active_in_ID_stage.instruction_pc_at_fetch : -1,
            active_in_ID_stage.raw_instruction,
            active_in_ID_stage.valid ? "T" : "F",
            active_in_ID_stage.valid ? get_opcode_name(active_in_ID_stage.decoded_info.opcode) : "---",
            active_in_ID_stage.cycles_spent_in_stage);
-    printf("EX                : Instr PC %2d, Raw 0x%08X, Valid: %s, Opcode: %-4s, CycInStg: %d, ALU: %d\n",
+    tracef("EX                : Instr PC %2d, Raw 0x%08X, Valid: %s, Opcode: %-4s, CycInStg: %d, ALU: %d\n",
            active_in_EX_stage.valid ? active_in_EX_stage.instruction_pc_at_fetch : -1,
            active_in_EX_stage.raw_instruction,
            active_in_EX_stage.valid ? "T" : "F",
            active_in_EX_stage.valid ? get_opcode_name(active_in_EX_stage.decoded_info.opcode) : "---",
            active_in_EX_stage.cycles_spent_in_stage,
            active_in_EX_stage.valid ? active_in_EX_stage.decoded_info.alu_result : 0);
-    printf("MEM               : Instr PC %2d, Raw 0x%08X, Valid: %s, Opcode: %-4s, MemRead: %d\n",
+    for (int i = 0; i < ex_in_flight_count; i++) {
+        tracef("EX (in flight)    : Instr PC %2d, Raw 0x%08X, Valid: T, Opcode: %-4s, CycInStg: %d\n",
+               ex_in_flight[i].instruction_pc_at_fetch, ex_in_flight[i].raw_instruction,
+               get_opcode_name(ex_in_flight[i].decoded_info.opcode), ex_in_flight[i].cycles_spent_in_stage);
+    }
+    tracef("MEM               : Instr PC %2d, Raw 0x%08X, Valid: %s, Opcode: %-4s, MemRead: %d\n",
            active_in_MEM_stage.valid ? active_in_MEM_stage.instruction_pc_at_fetch : -1,
            active_in_MEM_stage.raw_instruction,
            active_in_MEM_stage.valid ? "T" : "F",
            active_in_MEM_stage.valid ? get_opcode_name(active_in_MEM_stage.decoded_info.opcode) : "---",
            active_in_MEM_stage.valid ? active_in_MEM_stage.decoded_info.mem_read_val : 0);
-    printf("WB                : Instr PC %2d, Raw 0x%08X, Valid: %s, Opcode: %-4s\n",
+    tracef("WB                : Instr PC %2d, Raw 0x%08X, Valid: %s, Opcode: %-4s\n",
            active_in_WB_stage.valid ? active_in_WB_stage.instruction_pc_at_fetch : -1,
            active_in_WB_stage.raw_instruction,
            active_in_WB_stage.valid ? "T" : "F",
            active_in_WB_stage.valid ? get_opcode_name(active_in_WB_stage.decoded_info.opcode) : "---");
-    printf("-----------------------------------------------------------------------\n");
+    tracef("-----------------------------------------------------------------------\n");
 
     // Process stages in reverse order
-    write_back_stage_op();
-    if (can_MEM_operate_this_cycle) memory_access_stage_op();
-    execute_instruction_stage_op();
+    HOST_TIMED(HOST_WB, write_back_stage_op());
+    if (can_MEM_operate_this_cycle || pipeline_config.store_buffer_depth > 0) HOST_TIMED(HOST_MEM, memory_access_stage_op());
+    HOST_TIMED(HOST_EX, execute_instruction_stage_op());
 
     // Handle control hazards immediately after EX stage
     if (branch_taken_in_EX_cycle2) {
-        printf("Cycle %d: Control - Branch/Jump taken in EX to PC 0x%X. Flushing ID & IF contents.\n",
+        tracef("Cycle %d: Control - Branch/Jump taken in EX to PC 0x%X. Flushing ID & IF contents.\n",
                current_cycle, branch_target_pc);
         PC = branch_target_pc;
+        flush_branch_pc = active_in_EX_stage.instruction_pc_at_fetch;
         active_in_ID_stage.valid = false;
         memset(&active_in_ID_stage.decoded_info, 0, sizeof(DecodedInstruction));
         active_in_ID_stage.decoded_info.type = 'N';
@@ -788,108 +2263,3055 @@ void simulate_clock_cycle() {
         memset(&active_in_IF_stage.decoded_info, 0, sizeof(DecodedInstruction));
         active_in_IF_stage.decoded_info.type = 'N';
         suppress_IF_this_cycle = true; // Prevent IF from fetching this cycle
-        if (current_cycle % 2 != 0) {
+        if (taken_branch_stalls_IF(current_cycle)) {
             stall_IF_for_mem_after_branch = true;
-            printf("Cycle %d: Control - Scheduling IF stall for next cycle (Cycle %d) due to branch.\n", current_cycle, current_cycle + 1);
+            tracef("Cycle %d: Control - Scheduling IF stall for next cycle (Cycle %d) due to branch.\n", current_cycle, current_cycle + 1);
         }
         branch_taken_in_EX_cycle2 = false;
     }
 
     // Process remaining stages after flush
-    decode_instruction_stage_op();
-    if (hazard_detected) {
-        can_IF_operate_this_cycle = false;
-        active_in_EX_stage.valid = false; // Insert NOP
-        printf("Cycle %d: Control - Pipeline stalled for load-use hazard.\n", current_cycle);
-    } else if (can_IF_operate_this_cycle && !suppress_IF_this_cycle) {
-        fetch_instruction_stage_op();
-    } else if (suppress_IF_this_cycle) {
-        printf("Cycle %d: IF - Suppressed due to branch taken in EX.\n", current_cycle);
-        active_in_IF_stage.valid = false; // Ensure IF remains invalid
-        memset(&active_in_IF_stage.decoded_info, 0, sizeof(DecodedInstruction));
-        active_in_IF_stage.decoded_info.type = 'N';
+    HOST_TIMED(HOST_ID, decode_instruction_stage_op());
+
+    // Which latches empty at the end of this cycle. An instruction only moves
+    // on once the stage ahead of it is free, so a stage that has not finished
+    // (or cannot get the memory port) holds everything behind it. Instructions
+    // reach MEM in order: the oldest in ex_in_flight first, and the EX latch
+    // goes straight to MEM only when nothing is in flight.
+    StageStatus status = {
+        .MEM_valid = active_in_MEM_stage.valid,
+        .MEM_done = (can_MEM_operate_this_cycle || mem_port_bypassed) && mem_access_done(&active_in_MEM_stage),
+        .in_flight_count = ex_in_flight_count,
+        .in_flight_ready = ex_in_flight_count > 0 && ex_result_ready(&ex_in_flight[0]),
+        .EX_valid = active_in_EX_stage.valid,
+        .EX_done = active_in_EX_stage.cycles_spent_in_stage >= ex_occupancy_of(active_in_EX_stage.decoded_info.opcode),
+        .EX_ready = ex_result_ready(&active_in_EX_stage),
+        .ID_valid = active_in_ID_stage.valid,
+        .ID_ready = !hazard_detected && active_in_ID_stage.cycles_spent_in_stage >= pipeline_config.id_latency,
+    };
+    LatchMoves moves = plan_latch_moves(&status);
+
+    switch (fetch_decision(can_IF_operate_this_cycle, suppress_IF_this_cycle, hazard_detected, moves.ID_free,
+                           branch_unresolved())) {
+        case FETCH_HAZARD:
+            can_IF_operate_this_cycle = false; // The LW still latches into MEM; EX gets a bubble below
+            tracef("Cycle %d: Control - Pipeline stalled for load-use hazard.\n", current_cycle);
+            break;
+        case FETCH_ID_BUSY:
+            tracef("Cycle %d: IF - Stalled (ID occupied).\n", current_cycle);
+            can_IF_operate_this_cycle = false;
+            active_in_IF_stage.valid = false;
+            break;
+        case FETCH_BRANCH:
+            tracef("Cycle %d: IF - Stalled until the branch in flight resolves.\n", current_cycle);
+            can_IF_operate_this_cycle = false;
+            active_in_IF_stage.valid = false;
+            break;
+        case FETCH_GO:
+            HOST_TIMED(HOST_IF, fetch_instruction_stage_op());
+            break;
+        case FETCH_SUPPRESSED:
+            tracef("Cycle %d: IF - Suppressed due to branch taken in EX.\n", current_cycle);
+            active_in_IF_stage.valid = false; // Ensure IF remains invalid
+            memset(&active_in_IF_stage.decoded_info, 0, sizeof(DecodedInstruction));
+            active_in_IF_stage.decoded_info.type = 'N';
+            break;
     }
+    if (store_buffer_count > 0) HOST_TIMED(HOST_MEM, drain_store_buffer());
+
+    if (profiling_enabled) profile_cycle();
 
     // Latching
-    if (active_in_MEM_stage.valid && can_MEM_operate_this_cycle) {
+    HOST_TIMER_START(HOST_LATCH);
+    if (moves.MEM_leaves) {
         active_in_WB_stage = active_in_MEM_stage;
         active_in_WB_stage.cycles_spent_in_stage = 0;
     } else {
         active_in_WB_stage.valid = false;
     }
 
-    if (active_in_EX_stage.valid && active_in_EX_stage.cycles_spent_in_stage == 2) {
+    if (moves.in_flight_leaves) {
+        active_in_MEM_stage = ex_in_flight[0];
+        active_in_MEM_stage.cycles_spent_in_stage = 0;
+        ex_in_flight_count--;
+        memmove(&ex_in_flight[0], &ex_in_flight[1], ex_in_flight_count * sizeof(PipelineRegister));
+    } else if (moves.EX_to_MEM) {
         active_in_MEM_stage = active_in_EX_stage;
         active_in_MEM_stage.cycles_spent_in_stage = 0;
-    } else {
+    } else if (moves.MEM_free) {
         active_in_MEM_stage.valid = false;
     }
+    if (moves.EX_to_in_flight) ex_in_flight[ex_in_flight_count++] = active_in_EX_stage;
 
-    if (active_in_ID_stage.valid && active_in_ID_stage.cycles_spent_in_stage == 2 && !hazard_detected) {
+    if (moves.ID_leaves) {
         active_in_EX_stage = active_in_ID_stage;
         active_in_EX_stage.cycles_spent_in_stage = 0;
-    } else if (!(active_in_EX_stage.valid && active_in_EX_stage.cycles_spent_in_stage == 1)) {
+    } else if (moves.EX_free) {
         active_in_EX_stage.valid = false;
     }
 
-    if (active_in_IF_stage.valid && can_IF_operate_this_cycle && !suppress_IF_this_cycle && !hazard_detected) {
+    if (active_in_IF_stage.valid && can_IF_operate_this_cycle && !suppress_IF_this_cycle && moves.ID_free) {
         active_in_ID_stage = active_in_IF_stage;
         active_in_ID_stage.cycles_spent_in_stage = 0;
-    } else if (!(active_in_ID_stage.valid && active_in_ID_stage.cycles_spent_in_stage == 1)) {
+    } else if (moves.ID_free) {
         active_in_ID_stage.valid = false;
     }
+    HOST_TIMER_STOP(HOST_LATCH);
 
     // Halt conditions
-    static int empty_pipeline_cycles = 0;
     if (PC >= instructions_loaded_count && !active_in_IF_stage.valid && !active_in_ID_stage.valid &&
-        !active_in_EX_stage.valid && !active_in_MEM_stage.valid && !active_in_WB_stage.valid) {
+        !active_in_EX_stage.valid && ex_in_flight_count == 0 && !active_in_MEM_stage.valid && !active_in_WB_stage.valid &&
+        store_buffer_count == 0) {
         empty_pipeline_cycles++;
-        if (empty_pipeline_cycles > 2) {
-            halt_simulation = 1;
-            printf("\nHALT: PC (%d) >= Instructions Loaded (%d) and pipeline fully empty for %d cycles.\n", PC, instructions_loaded_count, empty_pipeline_cycles);
+        if (empty_pipeline_cycles >= HALT_EMPTY_CYCLES) {
+            halt_simulation = HALT_DRAINED;
+            tracef("\nHALT: PC (%d) >= Instructions Loaded (%d) and pipeline fully empty for %d cycles.\n", PC, instructions_loaded_count, empty_pipeline_cycles);
         }
     } else {
         empty_pipeline_cycles = 0;
     }
 
-    if (current_cycle > instructions_loaded_count + 30 && instructions_loaded_count > 0) {
-        printf("\nHALT: Cycle limit safety break (%d cycles for %d instructions).\n", current_cycle, instructions_loaded_count);
-        halt_simulation = 1;
+    if (cycle_limit > 0) {
+        if (!halt_simulation && current_cycle >= cycle_limit) {
+            tracef("\nHALT: Cycle limit reached (%d cycles).\n", current_cycle);
+            halt_simulation = HALT_CYCLE_LIMIT;
+        }
+    } else if (current_cycle > instructions_loaded_count * pipeline_cycle_scale() / 4 + 30 && instructions_loaded_count > 0) {
+        tracef("\nHALT: Cycle limit safety break (%d cycles for %d instructions).\n", current_cycle, instructions_loaded_count);
+        halt_simulation = HALT_CYCLE_LIMIT;
     }
     if (instructions_loaded_count == 0 && current_cycle > 10) {
-        printf("\nHALT: No program loaded after 10 cycles.\n");
-        halt_simulation = 1;
+        tracef("\nHALT: No program loaded after 10 cycles.\n");
+        halt_simulation = HALT_CYCLE_LIMIT;
     }
+    if (halt_simulation) flush_store_buffer();
+#ifdef HOST_PROFILE
+    host_cycles_stepped++;
+#endif
+    HOST_TIMER_STOP(HOST_CONTROL);
 }
-/////////////////////////////////////////////////////////////////////////////////////////////////////////////
-//////////////////////////////////////////////////////main///////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-// --- Main Simulation Loop ---
-int main(int argc, char* argv[]) {
-    if (argc == 2) {
-        initialize_processor();
-        load_assembly_file(argv[1]);
+// --- Idle-cycle skipping ---
+// With long EX or MEM latencies most cycles only count down: every valid stage
+// is waiting on its own latency, nothing is fetched, nothing moves. Such
+// cycles are not simulated one by one; skip_idle_cycles adds them to the stage
+// counters and current_cycle in one step and the loop resumes with the next
+// cycle in which something happens. Only used with tracing off, since the
+// trace prints every cycle.
+
+// Offset from now (1 = the next cycle) of the n-th cycle in which IF, or MEM,
+// has the memory port.
+long nth_port_cycle(bool for_MEM, long n) {
+    if (pipeline_config.split_memory_ports) return n;
+    bool next_is_MEM = MEM_port_cycle(current_cycle + 1);
+    return (next_is_MEM == for_MEM ? 1 : 2) + 2 * (n - 1);
+}
+
+// Number of upcoming cycles in which no stage does anything but count a
+// cycle. Each stage gives the offset of its next event (a fetch, a decode, an
+// EX result, a memory access, a latch moving on); a stage that only waits for
+// the one ahead of it has no event of its own, because its wait ends with
+// that stage's event.
+long idle_cycles_ahead() {
+    if (active_in_WB_stage.valid || stall_IF_for_mem_after_branch || branch_taken_in_EX_cycle2) return 0;
+    if (store_buffer_count > 0) return 0; // Drains in whichever port cycles stay idle
+
+    // Cheapest and most often decisive first: a flowing pipeline decodes or
+    // fetches in the very next cycle.
+    long next = LONG_MAX;
+    if (active_in_ID_stage.valid) {
+        if (active_in_ID_stage.cycles_spent_in_stage >= pipeline_config.id_latency) {
+            if (!active_in_EX_stage.valid) return 0;
+        } else {
+            next = pipeline_config.id_latency - active_in_ID_stage.cycles_spent_in_stage;
+        }
+    } else if (PC >= 0 && PC < instructions_loaded_count && PC <= INSTRUCTION_MEM_END && !branch_unresolved()) {
+        next = nth_port_cycle(false, 1);
     }
-    printf("\n--- Starting Simulation (Package 1 Logic) ---\n");
-    while (!halt_simulation) {
-        simulate_clock_cycle();
+    if (next <= 1) return 0;
+
+    if (active_in_EX_stage.valid) {
+        long occupancy = ex_occupancy_of(active_in_EX_stage.decoded_info.opcode);
+        if (active_in_EX_stage.cycles_spent_in_stage >= occupancy) {
+            if (ex_in_flight_count < EX_IN_FLIGHT_CAPACITY) return 0; // Moves on to MEM or into ex_in_flight
+        } else if (occupancy - active_in_EX_stage.cycles_spent_in_stage < next) {
+            next = occupancy - active_in_EX_stage.cycles_spent_in_stage;
+        }
     }
-    printf("\n--- Simulation Ended after %d cycles ---\n", current_cycle);
-    printf("Final Registers (including special purpose):\n");
-    printf("PC: %10d (0x%08X)\n", PC, (unsigned int)PC);
+    if (ex_in_flight_count > 0) {
+        const PipelineRegister* head = &ex_in_flight[0];
+        if (ex_result_ready(head)) {
+            if (!active_in_MEM_stage.valid) return 0;
+        } else if (ex_latency_of(head->decoded_info.opcode) - head->cycles_spent_in_stage < next) {
+            next = ex_latency_of(head->decoded_info.opcode) - head->cycles_spent_in_stage;
+        }
+    }
+    if (active_in_MEM_stage.valid) {
+        uint32_t opcode = active_in_MEM_stage.decoded_info.opcode;
+        if (pipeline_config.store_buffer_depth > 0 && active_in_MEM_stage.cycles_spent_in_stage == 0 &&
+            (opcode == OPCODE_LW || opcode == OPCODE_SW)) {
+            return 0; // May finish through the store buffer, port or not
+        }
+        long remaining = active_in_MEM_stage.decoded_info.type == 'N' ? 1 :
+                         mem_latency_of(active_in_MEM_stage.decoded_info.opcode) - active_in_MEM_stage.cycles_spent_in_stage;
+        long at = nth_port_cycle(true, remaining > 1 ? remaining : 1);
+        if (at < next) next = at;
+    }
+    if (next <= 1) return 0;
+
+    // IF keeps its valid bit after handing an instruction to ID until its next
+    // port cycle clears it; the drain count only starts once it is clear.
+    bool drained = PC >= instructions_loaded_count && !active_in_ID_stage.valid && !active_in_EX_stage.valid &&
+                   ex_in_flight_count == 0 && !active_in_MEM_stage.valid;
+    if (drained && active_in_IF_stage.valid) return 0;
+    if (drained && HALT_EMPTY_CYCLES - empty_pipeline_cycles < next) next = HALT_EMPTY_CYCLES - empty_pipeline_cycles;
+    if (next <= 1) return 0;
+
+    // The cycle that hits the cycle limit or safety break is simulated too.
+    long limit = LONG_MAX;
+    if (cycle_limit > 0) {
+        limit = (long)cycle_limit - current_cycle;
+    } else if (instructions_loaded_count > 0) {
+        limit = (long)instructions_loaded_count * pipeline_cycle_scale() / 4 + 31 - current_cycle;
+    }
+    if (instructions_loaded_count == 0 && 11 - current_cycle < limit) limit = 11 - current_cycle;
+    if (limit < next) next = limit;
+    return next > 1 ? next - 1 : 0;
+}
+
+// Fast-forwards over at most max_cycles idle cycles and returns how many were
+// skipped. The profiler still samples each of them.
+long skip_idle_cycles(long max_cycles) {
+    if (trace_enabled) return 0;
+    long n = idle_cycles_ahead();
+    if (n > max_cycles) n = max_cycles;
+    if (n <= 0) return 0;
+
+    bool drained = PC >= instructions_loaded_count && !active_in_ID_stage.valid && !active_in_EX_stage.valid &&
+                   ex_in_flight_count == 0 && !active_in_MEM_stage.valid;
+    bool MEM_counts = active_in_MEM_stage.valid && active_in_MEM_stage.decoded_info.type != 'N';
+    if (nth_port_cycle(false, 1) <= n) active_in_IF_stage.valid = false;
+    long step = profiling_enabled ? 1 : n;
+    for (long done = 0; done < n; done += step) {
+        long MEM_cycles = pipeline_config.split_memory_ports ? step : (current_cycle + step) / 2 - current_cycle / 2;
+        current_cycle += step;
+        if (active_in_ID_stage.valid) active_in_ID_stage.cycles_spent_in_stage += step;
+        if (active_in_EX_stage.valid) active_in_EX_stage.cycles_spent_in_stage += step;
+        for (int i = 0; i < ex_in_flight_count; i++) ex_in_flight[i].cycles_spent_in_stage += step;
+        if (MEM_counts) active_in_MEM_stage.cycles_spent_in_stage += MEM_cycles;
+        if (profiling_enabled) {
+            can_IF_operate_this_cycle = IF_port_cycle(current_cycle);
+            can_MEM_operate_this_cycle = MEM_port_cycle(current_cycle);
+            fetched_pc_this_cycle = -1;
+            fetched_pair_this_cycle = false;
+            profile_cycle();
+        }
+    }
+    empty_pipeline_cycles = drained ? empty_pipeline_cycles + n : 0;
+    hazard_detected = false;
+    idle_cycles_skipped += n;
+    return n;
+}
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////// state output //////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define DUMP_FULL   0 // Every register and memory word (original output)
+#define DUMP_DIFF   1 // Only registers/words that differ from the loaded image
+#define DUMP_BINARY 2 // Raw little-endian image to a file
+#define DUMP_JSON   3 // Registers + changed words as JSON
+
+#define STATE_DUMP_MAGIC   0x54534E56u // "VNST"
+#define STATE_DUMP_VERSION 1
+
+// Snapshot of the machine right after loading; the diff formats compare
+// against this.
+_Thread_local uint32_t initial_memory[MEMORY_SIZE];
+_Thread_local int32_t  initial_registers[NUM_REGISTERS];
+
+void snapshot_initial_state() {
+    memcpy(initial_memory, memory, sizeof(memory));
+    memcpy(initial_registers, registers, sizeof(registers));
+    clear_dirty_pages();
+}
+
+int parse_dump_format(const char* name) {
+    if (strcmp(name, "full") == 0) return DUMP_FULL;
+    if (strcmp(name, "diff") == 0) return DUMP_DIFF;
+    if (strcmp(name, "binary") == 0) return DUMP_BINARY;
+    if (strcmp(name, "json") == 0) return DUMP_JSON;
+    printf("Unknown dump format: %s (expected full, diff, binary or json)\n", name);
+    exit(1);
+}
+
+void print_full_state(FILE* out) {
+    fprintf(out, "Final Registers (including special purpose):\n");
+    fprintf(out, "PC: %10d (0x%08X)\n", PC, (unsigned int)PC);
     for (int i = 0; i < NUM_REGISTERS; i++) {
-        printf("R%02d: %10d (0x%08X)", i, registers[i], (unsigned int)registers[i]);
-        if ((i + 1) % 4 == 0) printf("\n"); else printf("  |  ");
+        fprintf(out, "R%02d: %10d (0x%08X)", i, registers[i], (unsigned int)registers[i]);
+        if ((i + 1) % 4 == 0) fprintf(out, "\n"); else fprintf(out, "  |  ");
     }
-    if (NUM_REGISTERS % 4 != 0) printf("\n");
-    printf("\nFinal Instruction Memory (0 to %d):\n", INSTRUCTION_MEM_END);
+    if (NUM_REGISTERS % 4 != 0) fprintf(out, "\n");
+    fprintf(out, "\nFinal Vector Registers (%d elements):\n", pipeline_config.vector_length);
+    for (int v = 0; v < NUM_VECTOR_REGISTERS; v++) {
+        fprintf(out, "V%d:", v);
+        for (int e = 0; e < pipeline_config.vector_length; e++) fprintf(out, " %d", vector_registers[v][e]);
+        fprintf(out, "\n");
+    }
+    fprintf(out, "\nFinal Instruction Memory (0 to %d):\n", INSTRUCTION_MEM_END);
     for (int i = 0; i <= INSTRUCTION_MEM_END && i < MEMORY_SIZE; i++) {
-        printf("Mem[%04d]: 0x%08X (%s)\n", i, memory[i], get_opcode_name((memory[i] >> 28) & 0xF));
+        fprintf(out, "Mem[%04d]: 0x%08X (%s)\n", i, memory[i], get_opcode_name((memory[i] >> 28) & 0xF));
     }
-    printf("\nFinal Data Memory (%d to %d):\n", DATA_MEM_START, MEMORY_SIZE - 1);
+    fprintf(out, "\nFinal Data Memory (%d to %d):\n", DATA_MEM_START, MEMORY_SIZE - 1);
     for (int i = DATA_MEM_START; i < MEMORY_SIZE; i++) {
-        printf("Mem[%04d]: %10d (0x%08X)\n", i, (int32_t)memory[i], memory[i]);
+        fprintf(out, "Mem[%04d]: %10d (0x%08X)\n", i, (int32_t)memory[i], memory[i]);
+    }
+}
+
+// Only walks pages written since the snapshot, so the cost is proportional
+// to what the program touched rather than to MEMORY_SIZE.
+void print_state_diff(FILE* out) {
+    fprintf(out, "Final State Diff (cycles %d, PC %d):\n", current_cycle, PC);
+    for (int r = 0; r < NUM_REGISTERS; r++) {
+        if (registers[r] != initial_registers[r]) {
+            fprintf(out, "R%02d: %10d -> %10d\n", r, initial_registers[r], registers[r]);
+        }
+    }
+    for (int p = 0; p < dirty_page_count; p++) {
+        int base = dirty_page_list[p] * DIRTY_PAGE_WORDS;
+        for (int a = base; a < base + DIRTY_PAGE_WORDS; a++) {
+            if (memory[a] != initial_memory[a]) {
+                fprintf(out, "Mem[%04d]: %10d -> %10d (0x%08X)\n", a, (int32_t)initial_memory[a], (int32_t)memory[a], memory[a]);
+            }
+        }
+    }
+}
+
+void print_state_json(FILE* out) {
+    fprintf(out, "{\n  \"cycles\": %d,\n  \"instructions_retired\": %ld,\n  \"pc\": %d,\n  \"registers\": [",
+            current_cycle, instructions_retired, PC);
+    for (int r = 0; r < NUM_REGISTERS; r++) {
+        fprintf(out, "%s%d", r == 0 ? "" : ", ", registers[r]);
+    }
+    fprintf(out, "],\n  \"memory_changes\": [");
+    bool first = true;
+    for (int p = 0; p < dirty_page_count; p++) {
+        int base = dirty_page_list[p] * DIRTY_PAGE_WORDS;
+        for (int a = base; a < base + DIRTY_PAGE_WORDS; a++) {
+            if (memory[a] != initial_memory[a]) {
+                fprintf(out, "%s\n    {\"addr\": %d, \"old\": %d, \"new\": %d}",
+                        first ? "" : ",", a, (int32_t)initial_memory[a], (int32_t)memory[a]);
+                first = false;
+            }
+        }
     }
+    fprintf(out, "%s]\n}\n", first ? "" : "\n  ");
+}
+
+void write_le32(FILE* out, uint32_t value) {
+    uint8_t bytes[4] = {value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF, (value >> 24) & 0xFF};
+    fwrite(bytes, 1, sizeof(bytes), out);
+}
+
+// Layout (all little-endian 32-bit words): magic, version, cycles, PC,
+// NUM_REGISTERS registers, MEMORY_SIZE memory words.
+void write_state_binary(FILE* out) {
+    write_le32(out, STATE_DUMP_MAGIC);
+    write_le32(out, STATE_DUMP_VERSION);
+    write_le32(out, (uint32_t)current_cycle);
+    write_le32(out, (uint32_t)PC);
+    for (int r = 0; r < NUM_REGISTERS; r++) write_le32(out, (uint32_t)registers[r]);
+    for (int a = 0; a < MEMORY_SIZE; a++) write_le32(out, memory[a]);
+}
+
+// Text formats go to stdout unless a file is given; binary needs a file.
+void dump_final_state(int format, const char* filename) {
+    FILE* out = stdout;
+    if (format == DUMP_BINARY && filename == NULL) filename = "final_state.bin";
+    if (filename != NULL) {
+        out = fopen(filename, format == DUMP_BINARY ? "wb" : "w");
+        if (out == NULL) {
+            printf("Error opening file: %s\n", filename);
+            exit(1);
+        }
+    }
+    switch (format) {
+        case DUMP_DIFF:   print_state_diff(out);   break;
+        case DUMP_BINARY: write_state_binary(out); break;
+        case DUMP_JSON:   print_state_json(out);   break;
+        default:          print_full_state(out);   break;
+    }
+    if (out != stdout) {
+        fclose(out);
+        printf("Final state written to %s\n", filename);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////// functional trace + replay /////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Functional-first timing. reference_run executes a program once and records
+// every dynamic instruction; replay_timing then applies only the pipeline's
+// timing rules to that trace, so one trace is timed under many configurations
+// (--sweep --replay) without re-running the semantics or copying full
+// pipeline registers. The replay keeps its own, smaller pipeline state but
+// takes every hazard, latency and port decision from the timing rules that
+// simulate_clock_cycle uses (instructions off the correct path are taken from
+// the program image). Every fuzz case, and one program per --sweep --replay
+// configuration, checks that both agree on cycles and retired instructions.
+#define TRACE_TAKEN        1 // BNE taken, or J
+#define TRACE_VECTOR_STORE 2 // VST (VLD otherwise)
+
+typedef struct {
+    int32_t  effective_address; // LW/SW/VLD/VST, else 0
+    uint16_t pc;
+    uint16_t registers;         // Register fields, instruction bits 13..27: r3 | r2 << 5 | r1 << 10
+    uint8_t  opcode;
+    uint8_t  flags;             // TRACE_*
+} TraceRecord;
+
+typedef struct {
+    TraceRecord* records;
+    long    count;
+    long    capacity;
+    int32_t end_pc; // PC after the last executed instruction
+} FunctionalTrace;
+
+#define TRACE_R1(rec) (((rec)->registers >> 10) & 0x1F)
+#define TRACE_R2(rec) (((rec)->registers >> 5) & 0x1F)
+#define TRACE_R3(rec) ((rec)->registers & 0x1F)
+
+TraceRecord make_trace_record(int32_t pc, uint32_t raw) {
+    TraceRecord record = {0};
+    record.pc = (uint16_t)pc;
+    record.registers = (raw >> 13) & 0x7FFF;
+    record.opcode = (raw >> 28) & 0xF;
+    if (record.opcode == OPCODE_VMEM && (raw & VMEM_STORE_BIT)) record.flags |= TRACE_VECTOR_STORE;
+    return record;
+}
+
+void append_trace_record(FunctionalTrace* trace, TraceRecord record) {
+    if (trace->count == trace->capacity) {
+        trace->capacity = trace->capacity ? trace->capacity * 2 : 4096;
+        trace->records = realloc(trace->records, trace->capacity * sizeof(TraceRecord));
+    }
+    trace->records[trace->count++] = record;
+}
+
+void free_functional_trace(FunctionalTrace* trace) {
+    free(trace->records);
+    memset(trace, 0, sizeof(*trace));
+}
+
+// One pipeline latch of the timing model: the instruction, its
+// cycles_spent_in_stage and its timing under the current configuration,
+// worked out once at fetch.
+typedef struct {
+    TraceRecord record;
+    long    index;        // Position in the trace, -1 when fetched off the correct path
+    int     cycles;
+    uint8_t ex_latency;
+    uint8_t ex_occupancy;
+    uint8_t mem_latency;  // 0 for NOP (leaves MEM without a cycle)
+    uint8_t forwards_reg; // R1_idx it forwards from EX/MEM (forwards_R1), 0 if none
+    uint8_t fused_reg;    // Destination of a fused ADDI, 0 if not fused
+    uint16_t fused_registers; // That ADDI's register fields
+    bool    valid;
+} ReplaySlot;
+
+typedef struct {
+    ReplaySlot IF, ID, EX, MEM, WB;
+    ReplaySlot in_flight[EX_IN_FLIGHT_CAPACITY];
+    int in_flight_count;
+    int32_t store_buffer[MAX_STORE_BUFFER_DEPTH]; // Addresses, oldest first
+    int store_buffer_count;
+    int store_buffer_cycles; // Port cycles the head entry has spent writing
+} ReplayPipeline;
+
+typedef struct {
+    long cycles;
+    long retired;
+    int  halt; // HALT_DRAINED or HALT_CYCLE_LIMIT
+} ReplayResult;
+
+void fill_replay_slot(ReplaySlot* slot, const TraceRecord* record, long index) {
+    uint8_t op = record->opcode;
+    slot->record = *record;
+    slot->index = index;
+    slot->cycles = 0;
+    slot->ex_latency = ex_latency_of(op);
+    slot->ex_occupancy = ex_occupancy_of(op);
+    slot->mem_latency = op == OPCODE_NOP ? 0 : mem_latency_of(op);
+    // R1_idx as decode leaves it: vector register writers and NOP carry 0
+    bool forwards = op != OPCODE_BNE && op != OPCODE_J && op != OPCODE_SW &&
+                    op != OPCODE_VMEM && op != OPCODE_VALU && op != OPCODE_NOP;
+    slot->forwards_reg = forwards ? TRACE_R1(record) : 0;
+    slot->fused_reg = 0;
+    slot->valid = true;
+}
+
+// Folds the ADDI before the slot's instruction into it (fetch_instruction_stage_op).
+void fuse_replay_slot(ReplaySlot* slot, const TraceRecord* addi) {
+    slot->fused_reg = TRACE_R1(addi);
+    slot->fused_registers = addi->registers;
+}
+
+bool replay_writes(const ReplaySlot* slot, uint32_t reg_idx) {
+    return slot->valid && (slot->forwards_reg == reg_idx || slot->fused_reg == reg_idx);
+}
+
+bool replay_loads(const ReplaySlot* slot, uint32_t reg_idx) {
+    return slot->record.opcode == OPCODE_LW && slot->forwards_reg == reg_idx;
+}
+
+// operand_pending
+bool replay_operand_pending(const ReplayPipeline* p, uint32_t reg_idx) {
+    if (reg_idx == 0) return false;
+    const ReplaySlot* ex = NULL;
+    if (replay_writes(&p->EX, reg_idx)) ex = &p->EX;
+    for (int i = p->in_flight_count - 1; i >= 0 && ex == NULL; i--) {
+        if (replay_writes(&p->in_flight[i], reg_idx)) ex = &p->in_flight[i];
+    }
+    if (ex != NULL) return EX_producer_pending(replay_loads(ex, reg_idx), ex->cycles, ex->ex_latency);
+    if (replay_writes(&p->MEM, reg_idx)) {
+        return MEM_producer_pending(replay_loads(&p->MEM, reg_idx), p->MEM.cycles, p->MEM.mem_latency);
+    }
+    return false;
+}
+
+// load_use_hazard
+bool replay_load_use(const ReplayPipeline* p, const TraceRecord* id) {
+    return p->EX.valid && p->EX.record.opcode == OPCODE_LW &&
+           load_use_conflict(p->EX.forwards_reg, id->opcode, TRACE_R1(id), TRACE_R2(id), TRACE_R3(id));
+}
+
+// The load-use and source_operands_pending checks of decode_instruction_stage_op
+bool replay_decode_stalls(const ReplayPipeline* p) {
+    const TraceRecord* id = &p->ID.record;
+    TraceRecord addi = {.registers = p->ID.fused_registers, .opcode = OPCODE_ADDI};
+    bool fused = p->ID.fused_reg != 0;
+    if (replay_load_use(p, id) || (fused && replay_load_use(p, &addi))) return true;
+    uint32_t sources[3];
+    int n = decode_source_registers(id->opcode, TRACE_R1(id), TRACE_R2(id), TRACE_R3(id),
+                                    p->ID.fused_reg, fused ? TRACE_R2(&addi) : 0, sources);
+    for (int i = 0; i < n; i++) {
+        if (replay_operand_pending(p, sources[i])) return true;
+    }
+    return false;
+}
+
+bool replay_writes_vector(const ReplaySlot* slot, uint32_t v_idx) {
+    uint8_t op = slot->record.opcode;
+    return slot->valid && (TRACE_R1(&slot->record) & 7) == v_idx &&
+           (op == OPCODE_VALU || (op == OPCODE_VMEM && !(slot->record.flags & TRACE_VECTOR_STORE)));
+}
+
+// vector_source != NULL
+bool replay_vector_ready(const ReplayPipeline* p, uint32_t v_idx) {
+    for (int i = p->in_flight_count - 1; i >= 0; i--) {
+        const ReplaySlot* older = &p->in_flight[i];
+        if (replay_writes_vector(older, v_idx)) {
+            return older->record.opcode != OPCODE_VMEM && older->cycles >= older->ex_latency;
+        }
+    }
+    if (replay_writes_vector(&p->MEM, v_idx) && p->MEM.record.opcode == OPCODE_VMEM) {
+        return p->MEM.cycles >= p->MEM.mem_latency;
+    }
+    return true;
+}
+
+// store_buffer_access: 1 if the instruction in MEM finished through the
+// store buffer this cycle, -1 if it waits on the buffer, 0 if it needs the
+// port as usual.
+int replay_store_buffer_access(ReplayPipeline* p) {
+    const TraceRecord* mem = &p->MEM.record;
+    int32_t address = mem->effective_address;
+    if (mem->opcode == OPCODE_SW && address >= DATA_MEM_START && address < MEMORY_SIZE) {
+        if (p->store_buffer_count == pipeline_config.store_buffer_depth) return -1;
+        p->store_buffer[p->store_buffer_count++] = address;
+        p->MEM.cycles = p->MEM.mem_latency;
+        return 1;
+    }
+    if (mem->opcode == OPCODE_LW && p->MEM.cycles == 0) {
+        for (int i = 0; i < p->store_buffer_count; i++) {
+            if (p->store_buffer[i] == address) {
+                p->MEM.cycles = p->MEM.mem_latency;
+                return 1;
+            }
+        }
+        return 0;
+    }
+    return (mem->opcode == OPCODE_VMEM && p->store_buffer_count > 0 && p->MEM.cycles == 0) ? -1 : 0;
+}
+
+bool replay_branch_unresolved(const ReplayPipeline* p) {
+    return branch_holds_fetch(p->ID.valid && is_branch_opcode(p->ID.record.opcode),
+                              p->EX.valid && is_branch_opcode(p->EX.record.opcode) && p->EX.cycles < p->EX.ex_latency);
+}
+
+// Times the trace under pipeline_config. image holds the program (for
+// instructions fetched past a taken branch before it resolves).
+ReplayResult replay_timing(const FunctionalTrace* trace, const uint32_t* image, int length, long cycle_limit) {
+    ReplayPipeline p;
+    memset(&p, 0, sizeof(p));
+    ReplayResult result = {0, 0, 0};
+    int32_t pc = 0;
+    long next_record = 0;  // Next trace record IF will fetch
+    bool wrong_path = false; // IF is past a taken branch that has not resolved
+    bool stall_IF_next = false;
+    int empty_cycles = 0;
+
+    while (!result.halt) {
+        long cycle = ++result.cycles;
+        bool can_IF = IF_port_cycle(cycle);
+        bool can_MEM = MEM_port_cycle(cycle);
+        if (stall_IF_next) {
+            can_IF = false;
+            stall_IF_next = false;
+        }
+        bool suppress_IF = false, taken = false;
+
+        if (p.WB.valid) result.retired += p.WB.fused_reg != 0 ? 2 : 1;
+        bool MEM_bypassed = false, MEM_port_used = false, fetched = false;
+        if (p.MEM.valid && p.MEM.mem_latency > 0) {
+            int buffered = pipeline_config.store_buffer_depth > 0 ? replay_store_buffer_access(&p) : 0;
+            MEM_bypassed = buffered > 0;
+            if (buffered == 0 && can_MEM) {
+                uint8_t op = p.MEM.record.opcode;
+                p.MEM.cycles++;
+                MEM_port_used = op == OPCODE_LW || op == OPCODE_SW || op == OPCODE_VMEM;
+            }
+        }
+        for (int i = 0; i < p.in_flight_count; i++) p.in_flight[i].cycles++;
+        if (p.EX.valid) {
+            uint8_t op = p.EX.record.opcode;
+            p.EX.cycles++;
+            if (op != OPCODE_NOP && p.EX.cycles == p.EX.ex_occupancy) {
+                uint32_t va = TRACE_R2(&p.EX.record) & 7, vb = TRACE_R3(&p.EX.record) & 7;
+                if ((op == OPCODE_VALU && (!replay_vector_ready(&p, va) || !replay_vector_ready(&p, vb))) ||
+                    (op == OPCODE_VSUM && !replay_vector_ready(&p, va))) {
+                    p.EX.cycles--;
+                } else {
+                    taken = op == OPCODE_J || (op == OPCODE_BNE && (p.EX.record.flags & TRACE_TAKEN));
+                }
+            }
+        }
+        if (taken) {
+            pc = p.EX.index + 1 < trace->count ? trace->records[p.EX.index + 1].pc : trace->end_pc;
+            p.ID.valid = false;
+            p.IF.valid = false;
+            suppress_IF = true;
+            wrong_path = false;
+            if (taken_branch_stalls_IF(cycle)) stall_IF_next = true;
+        }
+
+        bool hazard = false;
+        if (p.ID.valid && ++p.ID.cycles == pipeline_config.id_latency && replay_decode_stalls(&p)) {
+            hazard = true;
+            p.ID.cycles = 0;
+        }
+
+        StageStatus status = {
+            .MEM_valid = p.MEM.valid,
+            .MEM_done = (can_MEM || MEM_bypassed) && p.MEM.cycles >= p.MEM.mem_latency,
+            .in_flight_count = p.in_flight_count,
+            .in_flight_ready = p.in_flight_count > 0 && p.in_flight[0].cycles >= p.in_flight[0].ex_latency,
+            .EX_valid = p.EX.valid,
+            .EX_done = p.EX.cycles >= p.EX.ex_occupancy,
+            .EX_ready = p.EX.cycles >= p.EX.ex_latency,
+            .ID_valid = p.ID.valid,
+            .ID_ready = !hazard && p.ID.cycles >= pipeline_config.id_latency,
+        };
+        LatchMoves moves = plan_latch_moves(&status);
+
+        int fetch = fetch_decision(can_IF, suppress_IF, hazard, moves.ID_free, replay_branch_unresolved(&p));
+        if (fetch == FETCH_HAZARD) {
+            can_IF = false;
+        } else if (fetch == FETCH_ID_BUSY || fetch == FETCH_BRANCH) {
+            can_IF = false;
+            p.IF.valid = false;
+        } else if (fetch == FETCH_GO) {
+            if (pc >= 0 && pc < length && pc <= INSTRUCTION_MEM_END) {
+                int fused = fusion_at(image, pc, length) != FUSION_NONE;
+                if (!wrong_path && next_record + fused < trace->count) {
+                    fill_replay_slot(&p.IF, &trace->records[next_record + fused], next_record + fused);
+                    if (fused) fuse_replay_slot(&p.IF, &trace->records[next_record]);
+                    wrong_path = (p.IF.record.flags & TRACE_TAKEN) != 0;
+                    next_record += 1 + fused;
+                } else {
+                    TraceRecord record = make_trace_record(pc + fused, image[pc + fused]);
+                    fill_replay_slot(&p.IF, &record, -1);
+                    if (fused) {
+                        TraceRecord addi = make_trace_record(pc, image[pc]);
+                        fuse_replay_slot(&p.IF, &addi);
+                    }
+                }
+                pc += 1 + fused;
+                fetched = true;
+            } else {
+                p.IF.valid = false;
+            }
+        } else if (fetch == FETCH_SUPPRESSED) {
+            p.IF.valid = false;
+        }
+        // drain_store_buffer
+        if (p.store_buffer_count > 0 && store_buffer_may_drain(MEM_port_used, fetched, can_MEM) &&
+            ++p.store_buffer_cycles >= pipeline_config.mem_latency) {
+            p.store_buffer_count--;
+            p.store_buffer_cycles = 0;
+            memmove(&p.store_buffer[0], &p.store_buffer[1], p.store_buffer_count * sizeof(int32_t));
+        }
+
+        if (moves.MEM_leaves) {
+            p.WB = p.MEM;
+        } else {
+            p.WB.valid = false;
+        }
+        if (moves.in_flight_leaves) {
+            p.MEM = p.in_flight[0];
+            p.MEM.cycles = 0;
+            p.in_flight_count--;
+            memmove(&p.in_flight[0], &p.in_flight[1], p.in_flight_count * sizeof(ReplaySlot));
+        } else if (moves.EX_to_MEM) {
+            p.MEM = p.EX;
+            p.MEM.cycles = 0;
+        } else if (moves.MEM_free) {
+            p.MEM.valid = false;
+        }
+        if (moves.EX_to_in_flight) p.in_flight[p.in_flight_count++] = p.EX;
+        if (moves.ID_leaves) {
+            p.EX = p.ID;
+            p.EX.cycles = 0;
+        } else if (moves.EX_free) {
+            p.EX.valid = false;
+        }
+        if (p.IF.valid && can_IF && !suppress_IF && moves.ID_free) {
+            p.ID = p.IF;
+            p.ID.cycles = 0;
+        } else if (moves.ID_free) {
+            p.ID.valid = false;
+        }
+
+        if (pc >= length && !p.IF.valid && !p.ID.valid && !p.EX.valid && p.in_flight_count == 0 &&
+            !p.MEM.valid && !p.WB.valid && p.store_buffer_count == 0) {
+            if (++empty_cycles >= HALT_EMPTY_CYCLES) result.halt = HALT_DRAINED;
+        } else {
+            empty_cycles = 0;
+        }
+        if (!result.halt && cycle >= cycle_limit) result.halt = HALT_CYCLE_LIMIT;
+    }
+    return result;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////// reference + fuzzing ////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define FUZZ_MAX_PROGRAM_LEN   96
+#define FUZZ_MAX_REF_STEPS     20000
+#define FUZZ_LOOP_COUNTER_REG  31 // Reserved: loop trip counter
+#define FUZZ_ADDRESS_BASE_REG  30 // Reserved: LW/SW base address
+#define FUZZ_MAX_THREADS       64
+
+typedef struct {
+    uint8_t  opcode;
+    uint8_t  r1, r2, r3;
+    uint32_t shamt;
+    int32_t  immediate;
+    uint32_t address;
+} FuzzInstruction;
+
+// --- Reference Model ---
+// Plain one-instruction-at-a-time interpreter of the ISA, used as the golden
+// model for the pipeline. Returns the number of instructions executed, or -1
+// if the program left the instruction space or ran past max_steps. With a
+// trace, also records every executed instruction (the functional front end
+// of replay_timing).
+long reference_run(uint32_t* mem, int program_length, int32_t* regs, long max_steps, FunctionalTrace* trace) {
+    int32_t pc = 0;
+    long steps = 0;
+    int32_t vregs[NUM_VECTOR_REGISTERS][MAX_VECTOR_LENGTH] = {{0}};
+    int vlen = pipeline_config.vector_length;
+    memset(regs, 0, NUM_REGISTERS * sizeof(int32_t));
+
+    while (pc < program_length && pc <= INSTRUCTION_MEM_END) {
+        if (pc < 0 || steps >= max_steps) return -1;
+        uint32_t instr = mem[pc];
+        uint8_t  opcode = (instr >> 28) & 0xF;
+        uint32_t r1 = (instr >> 23) & 0x1F;
+        uint32_t r2 = (instr >> 18) & 0x1F;
+        uint32_t r3 = (instr >> 13) & 0x1F;
+        uint32_t shamt = instr & 0x1FFF;
+        int32_t  imm = instr & 0x3FFFF;
+        if (imm & (1 << 17)) imm |= ~0x3FFFF;
+        uint32_t a = (uint32_t)regs[r2];
+        int32_t  next_pc = pc + 1;
+        int32_t  result = 0;
+        int32_t  ea = 0;
+        bool     write = true;
+        bool     taken = false;
+
+        switch (opcode) {
+            case OPCODE_ADD:  result = (int32_t)(a + (uint32_t)regs[r3]); break;
+            case OPCODE_SUB:  result = (int32_t)(a - (uint32_t)regs[r3]); break;
+            case OPCODE_MULI: result = (int32_t)(a * (uint32_t)imm);      break;
+            case OPCODE_ADDI: result = (int32_t)(a + (uint32_t)imm);      break;
+            case OPCODE_ANDI: result = (int32_t)(a & (uint32_t)imm);      break;
+            case OPCODE_ORI:  result = (int32_t)(a | (uint32_t)imm);      break;
+            case OPCODE_SLL:  result = shamt < 32 ? (int32_t)(a << shamt) : 0; break;
+            case OPCODE_SRL:  result = shamt < 32 ? (int32_t)(a >> shamt) : 0; break;
+            case OPCODE_BNE:
+                write = false;
+                taken = regs[r1] != regs[r2];
+                if (taken) next_pc = pc + 1 + imm;
+                break;
+            case OPCODE_J:
+                write = false;
+                taken = true;
+                next_pc = (int32_t)(((uint32_t)(pc + 1) & 0xF0000000) | (instr & 0x0FFFFFFF));
+                break;
+            case OPCODE_LW: {
+                ea = (int32_t)(a + (uint32_t)imm);
+                result = (ea >= DATA_MEM_START && ea < MEMORY_SIZE) ? (int32_t)mem[ea] : 0;
+                break;
+            }
+            case OPCODE_SW: {
+                ea = (int32_t)(a + (uint32_t)imm);
+                write = false;
+                if (ea >= DATA_MEM_START && ea < MEMORY_SIZE) mem[ea] = (uint32_t)regs[r1];
+                break;
+            }
+            case OPCODE_VMEM: {
+                int32_t offset = instr & 0x1FFFF;
+                if (offset & (1 << 16)) offset |= ~0x1FFFF;
+                ea = (int32_t)(a + (uint32_t)offset);
+                write = false;
+                for (int e = 0; e < vlen; e++) {
+                    bool in_data = ea + e >= DATA_MEM_START && ea + e < MEMORY_SIZE;
+                    if (instr & VMEM_STORE_BIT) {
+                        if (in_data) mem[ea + e] = (uint32_t)vregs[r1 & 7][e];
+                    } else {
+                        vregs[r1 & 7][e] = in_data ? (int32_t)mem[ea + e] : 0;
+                    }
+                }
+                break;
+            }
+            case OPCODE_VALU:
+                write = false;
+                for (int e = 0; e < vlen; e++) {
+                    uint32_t x = (uint32_t)vregs[r2 & 7][e], y = (uint32_t)vregs[r3 & 7][e];
+                    vregs[r1 & 7][e] = (int32_t)((instr & VALU_SUB_BIT) ? x - y : x + y);
+                }
+                break;
+            case OPCODE_VSUM: {
+                uint32_t sum = 0;
+                for (int e = 0; e < vlen; e++) sum += (uint32_t)vregs[r2 & 7][e];
+                result = (int32_t)sum;
+                break;
+            }
+            default: // NOP and unassigned opcodes
+                write = false;
+                break;
+        }
+        if (write && r1 != 0) regs[r1] = result;
+        if (trace != NULL) {
+            TraceRecord record = make_trace_record(pc, instr);
+            record.effective_address = ea;
+            if (taken) record.flags |= TRACE_TAKEN;
+            append_trace_record(trace, record);
+        }
+        pc = next_pc;
+        steps++;
+    }
+    if (trace != NULL) trace->end_pc = pc;
+    return pc < 0 ? -1 : steps;
+}
+
+// --- Random Program Generator ---
+uint32_t fuzz_next_random(uint32_t* state) {
+    uint32_t x = *state; // xorshift32
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+int fuzz_random_range(uint32_t* state, int lo, int hi) {
+    return lo + (int)(fuzz_next_random(state) % (uint32_t)(hi - lo + 1));
+}
+
+int32_t fuzz_random_immediate(uint32_t* state) {
+    switch (fuzz_random_range(state, 0, 3)) {
+        case 0:  return fuzz_random_range(state, -131072, 131071); // Full 18-bit range
+        case 1:  return fuzz_random_range(state, -16, 16);
+        default: return fuzz_random_range(state, 0, 255);
+    }
+}
+
+// Destination registers exclude the reserved loop/address registers; R0 is
+// picked now and then to exercise write suppression.
+uint8_t fuzz_random_dest(uint32_t* state) {
+    return fuzz_random_range(state, 0, 15) == 0 ? 0 : fuzz_random_range(state, 1, FUZZ_ADDRESS_BASE_REG - 1);
+}
+
+FuzzInstruction fuzz_random_alu(uint32_t* state) {
+    static const uint8_t alu_opcodes[] = {
+        OPCODE_ADD, OPCODE_SUB, OPCODE_MULI, OPCODE_ADDI, OPCODE_ANDI,
+        OPCODE_ORI, OPCODE_SLL, OPCODE_SRL, OPCODE_NOP
+    };
+    FuzzInstruction in = {0};
+    in.opcode = alu_opcodes[fuzz_random_range(state, 0, sizeof(alu_opcodes) - 1)];
+    if (in.opcode == OPCODE_NOP) return in;
+    in.r1 = fuzz_random_dest(state);
+    in.r2 = fuzz_random_range(state, 0, NUM_REGISTERS - 1);
+    if (in.opcode == OPCODE_ADD || in.opcode == OPCODE_SUB) {
+        in.r3 = fuzz_random_range(state, 0, NUM_REGISTERS - 1);
+    } else if (in.opcode == OPCODE_SLL || in.opcode == OPCODE_SRL) {
+        in.shamt = fuzz_random_range(state, 0, 31);
+    } else {
+        in.immediate = fuzz_random_immediate(state);
+    }
+    return in;
+}
+
+// Emits "ADDI Rbase R0 base" followed by an LW/SW whose effective address
+// stays inside the data region; loads are sometimes followed by a dependent
+// instruction to provoke the load-use interlock. Half of the accesses go to
+// the first few data words so loads often read what an earlier store wrote
+// (store buffer forwarding).
+int fuzz_emit_memory_op(uint32_t* state, FuzzInstruction* out, int room) {
+    if (room < 3) return 0;
+    int n = 0;
+    int32_t top = fuzz_random_range(state, 0, 1) ? DATA_MEM_START + 7 : MEMORY_SIZE - 1;
+    int32_t base = fuzz_random_range(state, DATA_MEM_START, top);
+    int32_t offset = fuzz_random_range(state, DATA_MEM_START - base, top - base);
+    out[n++] = (FuzzInstruction){.opcode = OPCODE_ADDI, .r1 = FUZZ_ADDRESS_BASE_REG, .r2 = 0, .immediate = base};
+    FuzzInstruction mem_op = {.r2 = FUZZ_ADDRESS_BASE_REG, .immediate = offset};
+    if (fuzz_random_range(state, 0, 1)) {
+        mem_op.opcode = OPCODE_LW;
+        mem_op.r1 = fuzz_random_dest(state);
+        out[n++] = mem_op;
+        if (fuzz_random_range(state, 0, 1)) {
+            FuzzInstruction use = {.opcode = OPCODE_ADD, .r1 = fuzz_random_dest(state),
+                                   .r2 = mem_op.r1, .r3 = fuzz_random_range(state, 0, NUM_REGISTERS - 1)};
+            out[n++] = use;
+        }
+    } else {
+        mem_op.opcode = OPCODE_SW;
+        mem_op.r1 = fuzz_random_range(state, 0, NUM_REGISTERS - 1);
+        out[n++] = mem_op;
+    }
+    return n;
+}
+
+int fuzz_emit_straight_line(uint32_t* state, FuzzInstruction* out, int room) {
+    if (room >= 3 && fuzz_random_range(state, 0, 3) == 0) return fuzz_emit_memory_op(state, out, room);
+    out[0] = fuzz_random_alu(state);
+    return 1;
+}
+
+int generate_random_program(uint32_t* state, FuzzInstruction* program, int max_length) {
+    int n = 0;
+    int target_length = fuzz_random_range(state, 4, max_length);
+    while (n < target_length) {
+        int room = target_length - n;
+        int kind = fuzz_random_range(state, 0, 9);
+        if (kind == 0 && room >= 8) {
+            // Bounded loop: counter in R31, body must not touch it.
+            int trips = fuzz_random_range(state, 1, 4);
+            int body_room = room - 3 > 6 ? 6 : room - 3;
+            program[n++] = (FuzzInstruction){.opcode = OPCODE_ADDI, .r1 = FUZZ_LOOP_COUNTER_REG, .r2 = 0, .immediate = trips};
+            int body_start = n;
+            int body_length = fuzz_random_range(state, 1, body_room);
+            while (n - body_start < body_length) {
+                n += fuzz_emit_straight_line(state, &program[n], body_length - (n - body_start));
+            }
+            program[n++] = (FuzzInstruction){.opcode = OPCODE_ADDI, .r1 = FUZZ_LOOP_COUNTER_REG,
+                                             .r2 = FUZZ_LOOP_COUNTER_REG, .immediate = -1};
+            program[n] = (FuzzInstruction){.opcode = OPCODE_BNE, .r1 = FUZZ_LOOP_COUNTER_REG, .r2 = 0,
+                                           .immediate = body_start - n - 1};
+            n++;
+        } else if (kind <= 2 && room >= 2) {
+            // Forward skip over a few instructions via BNE or J.
+            int skip = fuzz_random_range(state, 1, room - 1 > 3 ? 3 : room - 1);
+            if (kind == 1) {
+                program[n] = (FuzzInstruction){.opcode = OPCODE_BNE, .r1 = fuzz_random_range(state, 0, NUM_REGISTERS - 1),
+                                               .r2 = fuzz_random_range(state, 0, NUM_REGISTERS - 1), .immediate = skip};
+            } else {
+                program[n] = (FuzzInstruction){.opcode = OPCODE_J, .address = n + 1 + skip};
+            }
+            n++;
+            for (int k = 0; k < skip; k++) program[n++] = fuzz_random_alu(state);
+        } else {
+            n += fuzz_emit_straight_line(state, &program[n], room);
+        }
+    }
+    return n;
+}
+
+uint32_t encode_fuzz_instruction(const FuzzInstruction* in) {
+    uint32_t op = in->opcode;
+    switch (op) {
+        case OPCODE_ADD: case OPCODE_SUB: case OPCODE_SLL: case OPCODE_SRL:
+            return (op << 28) | (in->r1 << 23) | (in->r2 << 18) | (in->r3 << 13) | (in->shamt & 0x1FFF);
+        case OPCODE_J:
+            return (op << 28) | (in->address & 0x0FFFFFFF);
+        case OPCODE_NOP:
+            return (op << 28);
+        default:
+            return (op << 28) | (in->r1 << 23) | (in->r2 << 18) | ((uint32_t)in->immediate & 0x3FFFF);
+    }
+}
+
+// Writes the instruction in the syntax accepted by load_assembly_file.
+void print_fuzz_instruction(FILE* out, const FuzzInstruction* in) {
+    const char* name = get_opcode_name(in->opcode);
+    switch (in->opcode) {
+        case OPCODE_ADD: case OPCODE_SUB:
+            fprintf(out, "%s R%d R%d R%d\n", name, in->r1, in->r2, in->r3); break;
+        case OPCODE_SLL: case OPCODE_SRL:
+            fprintf(out, "%s R%d R%d %u\n", name, in->r1, in->r2, in->shamt); break;
+        case OPCODE_LW: case OPCODE_SW:
+            fprintf(out, "%s R%d %d(R%d)\n", name, in->r1, in->immediate, in->r2); break;
+        case OPCODE_J:
+            fprintf(out, "%s %u\n", name, in->address); break;
+        case OPCODE_NOP:
+            fprintf(out, "%s\n", name); break;
+        default:
+            fprintf(out, "%s R%d R%d %d\n", name, in->r1, in->r2, in->immediate); break;
+    }
+}
+
+// --- Differential Check ---
+#define FUZZ_PASS     0
+#define FUZZ_MISMATCH 1
+#define FUZZ_NO_HALT  2
+#define FUZZ_INVALID  3 // Reference did not terminate; not a usable test case
+
+typedef struct {
+    int  verdict;
+    long reference_steps;
+    long pipeline_cycles;
+    char detail[128];
+} FuzzOutcome;
+
+// Runs the program through the reference model and the pipeline (on the
+// calling thread's machine state) and compares registers and data memory,
+// then checks that replaying the reference trace gives the pipeline's timing.
+FuzzOutcome fuzz_check_program(const FuzzInstruction* program, int length) {
+    FuzzOutcome outcome = {.verdict = FUZZ_PASS};
+    static _Thread_local uint32_t reference_memory[MEMORY_SIZE];
+    static _Thread_local FunctionalTrace trace; // Buffer reused across cases
+    int32_t reference_registers[NUM_REGISTERS];
+
+    memset(reference_memory, 0, sizeof(reference_memory));
+    for (int i = 0; i < length; i++) reference_memory[i] = encode_fuzz_instruction(&program[i]);
+    trace.count = 0;
+    outcome.reference_steps = reference_run(reference_memory, length, reference_registers, FUZZ_MAX_REF_STEPS, &trace);
+    if (outcome.reference_steps < 0) {
+        outcome.verdict = FUZZ_INVALID;
+        return outcome;
+    }
+
+    initialize_processor();
+    trace_enabled = false;
+    for (int i = 0; i < length; i++) memory[i] = encode_fuzz_instruction(&program[i]);
+    instructions_loaded_count = length;
+    cycle_limit = (int)(outcome.reference_steps * 2 * pipeline_cycle_scale()) + 64;
+    while (!halt_simulation) {
+        skip_idle_cycles(LONG_MAX);
+        simulate_clock_cycle();
+    }
+    outcome.pipeline_cycles = current_cycle;
+
+    if (halt_simulation != HALT_DRAINED) {
+        outcome.verdict = FUZZ_NO_HALT;
+        snprintf(outcome.detail, sizeof(outcome.detail), "pipeline did not drain within %d cycles", cycle_limit);
+        return outcome;
+    }
+    for (int r = 0; r < NUM_REGISTERS; r++) {
+        if (registers[r] != reference_registers[r]) {
+            outcome.verdict = FUZZ_MISMATCH;
+            snprintf(outcome.detail, sizeof(outcome.detail), "R%d: pipeline %d, reference %d",
+                     r, registers[r], reference_registers[r]);
+            return outcome;
+        }
+    }
+    for (int a = DATA_MEM_START; a < MEMORY_SIZE; a++) {
+        if (memory[a] != reference_memory[a]) {
+            outcome.verdict = FUZZ_MISMATCH;
+            snprintf(outcome.detail, sizeof(outcome.detail), "Mem[%04d]: pipeline %d, reference %d",
+                     a, (int32_t)memory[a], (int32_t)reference_memory[a]);
+            return outcome;
+        }
+    }
+    ReplayResult replay = replay_timing(&trace, memory, length, cycle_limit);
+    if (replay.cycles != current_cycle || replay.retired != instructions_retired) {
+        outcome.verdict = FUZZ_MISMATCH;
+        snprintf(outcome.detail, sizeof(outcome.detail), "timing replay: %ld cycles / %ld retired, pipeline %d / %ld",
+                 replay.cycles, replay.retired, current_cycle, instructions_retired);
+    }
+    return outcome;
+}
+
+// --- Test Case Minimization ---
+// Delta-debugging style: repeatedly drop chunks of instructions (halving the
+// chunk size when nothing can be dropped) while the case keeps failing.
+// Branch and jump targets are moved along with the code, so a BNE or J still
+// lands on the same instruction, or on the one after a removed target.
+
+// Where instruction `target` ends up once [start, end) is dropped.
+int32_t fuzz_retarget(int32_t target, int start, int end) {
+    if (target < start) return target;
+    return target < end ? start : target - (end - start);
+}
+
+int minimize_failing_program(FuzzInstruction* program, int length) {
+    FuzzInstruction candidate[FUZZ_MAX_PROGRAM_LEN];
+    for (int chunk = length / 2; chunk >= 1; ) {
+        bool removed_any = false;
+        for (int start = 0; start < length && length > 1; ) {
+            int end = start + chunk > length ? length : start + chunk;
+            int n = 0;
+            for (int i = 0; i < length; i++) {
+                if (i >= start && i < end) continue;
+                candidate[n] = program[i];
+                if (program[i].opcode == OPCODE_BNE) {
+                    candidate[n].immediate = fuzz_retarget(i + 1 + program[i].immediate, start, end) - (n + 1);
+                } else if (program[i].opcode == OPCODE_J) {
+                    candidate[n].address = (uint32_t)fuzz_retarget((int32_t)program[i].address, start, end);
+                }
+                n++;
+            }
+            FuzzOutcome o = fuzz_check_program(candidate, n);
+            if (o.verdict == FUZZ_MISMATCH || o.verdict == FUZZ_NO_HALT) {
+                memcpy(program, candidate, n * sizeof(FuzzInstruction));
+                length = n;
+                removed_any = true;
+            } else {
+                start += chunk;
+            }
+        }
+        if (!removed_any) chunk /= 2;
+    }
+    return length;
+}
+
+// --- Campaign Driver ---
+typedef struct {
+    int      total_cases;
+    uint32_t seed;
+    int      next_case;
+    int      passed, failed, invalid;
+    long     simulated_cycles;
+    long     reference_steps;
+    int      first_failing_case;
+    pthread_mutex_t lock;
+} FuzzCampaign;
+
+uint32_t fuzz_case_seed(uint32_t seed, int case_index) {
+    uint32_t s = seed ^ ((uint32_t)case_index * 0x9E3779B9u);
+    s ^= s >> 16;
+    s *= 0x85EBCA6Bu;
+    s ^= s >> 13;
+    return s ? s : 0xA5A5A5A5u;
+}
+
+void* fuzz_worker(void* arg) {
+    FuzzCampaign* campaign = (FuzzCampaign*)arg;
+    FuzzInstruction program[FUZZ_MAX_PROGRAM_LEN];
+    pipeline_config = configured_pipeline;
+    for (;;) {
+        pthread_mutex_lock(&campaign->lock);
+        int case_index = campaign->next_case++;
+        pthread_mutex_unlock(&campaign->lock);
+        if (case_index >= campaign->total_cases) break;
+
+        uint32_t state = fuzz_case_seed(campaign->seed, case_index);
+        int length = generate_random_program(&state, program, FUZZ_MAX_PROGRAM_LEN);
+        FuzzOutcome o = fuzz_check_program(program, length);
+
+        pthread_mutex_lock(&campaign->lock);
+        if (o.verdict == FUZZ_PASS) {
+            campaign->passed++;
+        } else if (o.verdict == FUZZ_INVALID) {
+            campaign->invalid++;
+        } else {
+            campaign->failed++;
+            if (campaign->first_failing_case < 0 || case_index < campaign->first_failing_case) {
+                campaign->first_failing_case = case_index;
+            }
+        }
+        campaign->simulated_cycles += o.pipeline_cycles;
+        campaign->reference_steps += o.reference_steps > 0 ? o.reference_steps : 0;
+        pthread_mutex_unlock(&campaign->lock);
+    }
+    host_profile_merge();
+    return NULL;
+}
+
+int default_host_threads() {
+#ifdef _SC_NPROCESSORS_ONLN
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > 0) return n > FUZZ_MAX_THREADS ? FUZZ_MAX_THREADS : (int)n;
+#endif
+    return 4;
+}
+
+// Returns 0 if every case matched the reference, 1 otherwise. The lowest
+// failing case is regenerated, minimized and saved as an assembly file.
+int run_fuzz_campaign(int total_cases, uint32_t seed, int num_threads) {
+    FuzzCampaign campaign = {.total_cases = total_cases, .seed = seed, .first_failing_case = -1};
+    pthread_t threads[FUZZ_MAX_THREADS];
+    struct timespec t0, t1;
+
+    if (num_threads < 1) num_threads = 1;
+    if (num_threads > FUZZ_MAX_THREADS) num_threads = FUZZ_MAX_THREADS;
+    pthread_mutex_init(&campaign.lock, NULL);
+    printf("Fuzzing: %d programs, seed %u, %d threads\n", total_cases, seed, num_threads);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int t = 0; t < num_threads; t++) pthread_create(&threads[t], NULL, fuzz_worker, &campaign);
+    for (int t = 0; t < num_threads; t++) pthread_join(threads[t], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    pthread_mutex_destroy(&campaign.lock);
+
+    double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("Passed: %d  Failed: %d  Discarded (reference did not terminate): %d\n",
+           campaign.passed, campaign.failed, campaign.invalid);
+    printf("Simulated %ld cycles / %ld instructions in %.2f s (%.0f programs/s)\n",
+           campaign.simulated_cycles, campaign.reference_steps, seconds,
+           seconds > 0 ? total_cases / seconds : 0.0);
+    if (campaign.failed == 0) return 0;
+
+    FuzzInstruction program[FUZZ_MAX_PROGRAM_LEN];
+    uint32_t state = fuzz_case_seed(seed, campaign.first_failing_case);
+    int length = generate_random_program(&state, program, FUZZ_MAX_PROGRAM_LEN);
+    int original_length = length;
+    length = minimize_failing_program(program, length);
+    FuzzOutcome o = fuzz_check_program(program, length);
+
+    char filename[64];
+    snprintf(filename, sizeof(filename), "fuzz_failure_%u_%d.txt", seed, campaign.first_failing_case);
+    printf("\nFirst failing case: %d (minimized %d -> %d instructions): %s\n",
+           campaign.first_failing_case, original_length, length, o.detail);
+    FILE* f = fopen(filename, "w");
+    for (int i = 0; i < length; i++) {
+        print_fuzz_instruction(stdout, &program[i]);
+        if (f != NULL) print_fuzz_instruction(f, &program[i]);
+    }
+    if (f != NULL) {
+        fclose(f);
+        printf("Reproducer written to %s\n", filename);
+    }
+    return 1;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////// debugger /////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define MAX_BREAKPOINTS 32
+
+#define BREAK_ON_PC    0 // Instruction at PC fetched
+#define BREAK_ON_CYCLE 1 // current_cycle reaches value
+#define WATCH_REGISTER 2 // registers[target] changes
+#define WATCH_MEMORY   3 // memory[target] changes (data region)
+
+typedef struct {
+    int     kind;
+    int     target;
+    int32_t last_value;
+    bool    in_use;
+} Breakpoint;
+
+Breakpoint breakpoints[MAX_BREAKPOINTS];
+
+const char* breakpoint_kind_name(int kind) {
+    switch (kind) {
+        case BREAK_ON_PC:    return "pc";
+        case BREAK_ON_CYCLE: return "cycle";
+        case WATCH_REGISTER: return "watch reg";
+        case WATCH_MEMORY:   return "watch mem";
+        default: return "?";
+    }
+}
+
+int add_breakpoint(int kind, int target) {
+    for (int i = 0; i < MAX_BREAKPOINTS; i++) {
+        if (!breakpoints[i].in_use) {
+            breakpoints[i].kind = kind;
+            breakpoints[i].target = target;
+            breakpoints[i].in_use = true;
+            if (kind == WATCH_REGISTER) breakpoints[i].last_value = registers[target];
+            if (kind == WATCH_MEMORY)   breakpoints[i].last_value = (int32_t)memory[target];
+            return i;
+        }
+    }
+    printf("Too many breakpoints (max %d).\n", MAX_BREAKPOINTS);
+    return -1;
+}
+
+// True if IF fetched the instruction at pc this cycle, alone or as either
+// half of a fused pair.
+bool fetched_this_cycle(int32_t pc) {
+    if (fetched_pc_this_cycle < 0) return false;
+    return pc == fetched_pc_this_cycle || (fetched_pair_this_cycle && pc == fetched_pc_this_cycle + 1);
+}
+
+// Called once per cycle while running at full speed; returns the index of
+// the first breakpoint that hit, or -1. Watchpoints re-arm on every change.
+int check_breakpoints() {
+    int hit = -1;
+    for (int i = 0; i < MAX_BREAKPOINTS; i++) {
+        Breakpoint* bp = &breakpoints[i];
+        if (!bp->in_use) continue;
+        switch (bp->kind) {
+            case BREAK_ON_PC:
+                if (fetched_this_cycle(bp->target) && hit < 0) hit = i;
+                break;
+            case BREAK_ON_CYCLE:
+                if (current_cycle == bp->target && hit < 0) hit = i;
+                break;
+            case WATCH_REGISTER:
+                if (registers[bp->target] != bp->last_value) {
+                    printf("Watchpoint %d: R%d changed %d -> %d\n", i, bp->target, bp->last_value, registers[bp->target]);
+                    bp->last_value = registers[bp->target];
+                    if (hit < 0) hit = i;
+                }
+                break;
+            case WATCH_MEMORY:
+                if ((int32_t)memory[bp->target] != bp->last_value) {
+                    printf("Watchpoint %d: Mem[%04d] changed %d -> %d\n", i, bp->target, bp->last_value, (int32_t)memory[bp->target]);
+                    bp->last_value = (int32_t)memory[bp->target];
+                    if (hit < 0) hit = i;
+                }
+                break;
+        }
+    }
+    return hit;
+}
+
+void print_pipeline_latch(const char* name, const PipelineRegister* stage) {
+    if (!stage->valid) {
+        printf("%-3s: ---\n", name);
+        return;
+    }
+    const DecodedInstruction* d = &stage->decoded_info;
+    printf("%-3s: PC %4d  0x%08X  %-4s  CycInStg %d  R1=%u R2=%u R3=%u  Imm=%d  ALU=%d  MemRead=%d\n",
+           name, stage->instruction_pc_at_fetch, stage->raw_instruction, get_opcode_name(d->opcode),
+           stage->cycles_spent_in_stage, d->R1_idx, d->R2_idx, d->R3_idx, d->immediate, d->alu_result, d->mem_read_val);
+}
+
+void print_pipeline_latches() {
+    printf("Cycle %d, PC %d, retired %ld\n", current_cycle, PC, instructions_retired);
+    print_pipeline_latch("IF", &active_in_IF_stage);
+    print_pipeline_latch("ID", &active_in_ID_stage);
+    print_pipeline_latch("EX", &active_in_EX_stage);
+    for (int i = ex_in_flight_count - 1; i >= 0; i--) print_pipeline_latch("EX+", &ex_in_flight[i]);
+    print_pipeline_latch("MEM", &active_in_MEM_stage);
+    print_pipeline_latch("WB", &active_in_WB_stage);
+}
+
+void print_registers() {
+    printf("PC: %10d (0x%08X)\n", PC, (unsigned int)PC);
+    for (int i = 0; i < NUM_REGISTERS; i++) {
+        printf("R%02d: %10d (0x%08X)", i, registers[i], (unsigned int)registers[i]);
+        if ((i + 1) % 4 == 0) printf("\n"); else printf("  |  ");
+    }
+    if (NUM_REGISTERS % 4 != 0) printf("\n");
+}
+
+void print_debugger_help() {
+    printf("Commands:\n");
+    printf("  run | continue | c         run at full speed until a breakpoint or halt\n");
+    printf("  step [n] | s [n]           advance n cycles (traced)\n");
+    printf("  stepi [n] | si [n]         advance until n more instructions retire (traced)\n");
+    printf("  break <pc>                 stop when the instruction at <pc> is fetched\n");
+    printf("                             (with fusion=on a fused pair steps and breaks as one instruction)\n");
+    printf("  break cycle <n>            stop at cycle <n>\n");
+    printf("  watch R<n>                 stop when register R<n> changes\n");
+    printf("  watch <addr>               stop when data word Mem[<addr>] changes (%d..%d)\n", DATA_MEM_START, MEMORY_SIZE - 1);
+    printf("  delete <id> | info break   remove / list breakpoints\n");
+    printf("  regs | pipe                show registers / pipeline latches\n");
+    printf("  mem <addr> [count]         dump memory words\n");
+    printf("  trace on|off               per-cycle output while stepping\n");
+    printf("  restart | quit\n");
+}
+
+// Advances the machine until max_cycles elapse, the given number of
+// instructions retire (if > 0), a breakpoint hits or the program halts.
+void debugger_advance(long max_cycles, long retire_target, bool traced) {
+    bool saved_trace = trace_enabled;
+    trace_enabled = traced;
+    long start_retired = instructions_retired;
+    for (long n = 0; n < max_cycles && !halt_simulation; n++) {
+        simulate_clock_cycle();
+        int hit = check_breakpoints();
+        if (hit >= 0) {
+            if (breakpoints[hit].kind == BREAK_ON_PC) {
+                printf("Breakpoint %d: instruction %d fetched at cycle %d.\n", hit, breakpoints[hit].target, current_cycle);
+            } else if (breakpoints[hit].kind == BREAK_ON_CYCLE) {
+                printf("Breakpoint %d: reached cycle %d.\n", hit, current_cycle);
+            }
+            break;
+        }
+        if (retire_target > 0 && instructions_retired - start_retired >= retire_target) break;
+    }
+    trace_enabled = saved_trace;
+    if (halt_simulation) {
+        printf("Program halted after %d cycles (%ld instructions retired).\n", current_cycle, instructions_retired);
+    }
+}
+
+int run_debugger(const char* program_file) {
+    char line[256];
+    bool step_trace = true;
+
+    initialize_processor();
+    if (program_file != NULL) load_assembly_file(program_file);
+    printf("Debugger ready. Type 'help' for commands.\n");
+
+    for (;;) {
+        printf("(sim) ");
+        fflush(stdout);
+        if (fgets(line, sizeof(line), stdin) == NULL) break;
+
+        char* tokens[4];
+        int token_count = 0;
+        char* token = strtok(line, " \t\r\n");
+        while (token != NULL && token_count < 4) {
+            tokens[token_count++] = token;
+            token = strtok(NULL, " \t\r\n");
+        }
+        if (token_count == 0) continue;
+        const char* cmd = tokens[0];
+        long count = token_count > 1 ? atol(tokens[1]) : 1;
+        if (count < 1) count = 1;
+
+        if (strcmp(cmd, "run") == 0 || strcmp(cmd, "continue") == 0 || strcmp(cmd, "c") == 0) {
+            debugger_advance(cycle_limit > 0 ? cycle_limit : INT_MAX, 0, false);
+            if (!halt_simulation) print_pipeline_latches();
+        } else if (strcmp(cmd, "step") == 0 || strcmp(cmd, "s") == 0) {
+            debugger_advance(count, 0, step_trace);
+            print_pipeline_latches();
+        } else if (strcmp(cmd, "stepi") == 0 || strcmp(cmd, "si") == 0) {
+            debugger_advance(INT_MAX, count, step_trace);
+            print_pipeline_latches();
+        } else if (strcmp(cmd, "break") == 0 && token_count == 3 && strcmp(tokens[1], "cycle") == 0) {
+            int id = add_breakpoint(BREAK_ON_CYCLE, atoi(tokens[2]));
+            if (id >= 0) printf("Breakpoint %d at cycle %d\n", id, atoi(tokens[2]));
+        } else if (strcmp(cmd, "break") == 0 && token_count == 2) {
+            int pc = atoi(tokens[1]);
+            if (pc < 0 || pc > INSTRUCTION_MEM_END) {
+                printf("PC must be in 0..%d\n", INSTRUCTION_MEM_END);
+                continue;
+            }
+            int id = add_breakpoint(BREAK_ON_PC, pc);
+            if (id >= 0) printf("Breakpoint %d at PC %d\n", id, pc);
+        } else if (strcmp(cmd, "watch") == 0 && token_count == 2) {
+            if (tokens[1][0] == 'R') {
+                int reg = atoi(tokens[1] + 1);
+                if (reg < 0 || reg >= NUM_REGISTERS) {
+                    printf("Invalid register: %s\n", tokens[1]);
+                    continue;
+                }
+                int id = add_breakpoint(WATCH_REGISTER, reg);
+                if (id >= 0) printf("Watchpoint %d on R%d\n", id, reg);
+            } else {
+                int addr = atoi(tokens[1]);
+                if (addr < DATA_MEM_START || addr >= MEMORY_SIZE) {
+                    printf("Address must be in the data region %d..%d\n", DATA_MEM_START, MEMORY_SIZE - 1);
+                    continue;
+                }
+                int id = add_breakpoint(WATCH_MEMORY, addr);
+                if (id >= 0) printf("Watchpoint %d on Mem[%04d]\n", id, addr);
+            }
+        } else if (strcmp(cmd, "delete") == 0 && token_count == 2) {
+            int id = atoi(tokens[1]);
+            if (id >= 0 && id < MAX_BREAKPOINTS) breakpoints[id].in_use = false;
+        } else if (strcmp(cmd, "info") == 0) {
+            for (int i = 0; i < MAX_BREAKPOINTS; i++) {
+                if (breakpoints[i].in_use) {
+                    printf("%2d: %-9s %d\n", i, breakpoint_kind_name(breakpoints[i].kind), breakpoints[i].target);
+                }
+            }
+        } else if (strcmp(cmd, "regs") == 0) {
+            print_registers();
+        } else if (strcmp(cmd, "pipe") == 0) {
+            print_pipeline_latches();
+        } else if (strcmp(cmd, "mem") == 0 && token_count >= 2) {
+            int addr = atoi(tokens[1]);
+            int n = token_count > 2 ? atoi(tokens[2]) : 1;
+            for (int a = addr; a < addr + n && a < MEMORY_SIZE; a++) {
+                if (a < 0) continue;
+                printf("Mem[%04d]: %10d (0x%08X)\n", a, (int32_t)memory[a], memory[a]);
+            }
+        } else if (strcmp(cmd, "trace") == 0 && token_count == 2) {
+            step_trace = strcmp(tokens[1], "on") == 0;
+        } else if (strcmp(cmd, "restart") == 0) {
+            initialize_processor();
+            if (program_file != NULL) load_assembly_file(program_file);
+            for (int i = 0; i < MAX_BREAKPOINTS; i++) {
+                if (breakpoints[i].kind == WATCH_REGISTER) breakpoints[i].last_value = registers[breakpoints[i].target];
+                if (breakpoints[i].kind == WATCH_MEMORY)   breakpoints[i].last_value = (int32_t)memory[breakpoints[i].target];
+            }
+        } else if (strcmp(cmd, "quit") == 0 || strcmp(cmd, "q") == 0) {
+            break;
+        } else {
+            print_debugger_help();
+        }
+    }
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////// gdb remote stub ////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// GDB has no description of this ISA, so the stub presents the machine as
+// riscv:rv32 (x0..x31 + pc, x0 hard-wired to zero like R0). Memory is word
+// addressed: GDB byte address A maps to memory[A / 4], little endian, and
+// pc is reported as PC * 4. Breakpoints stop before the instruction at the
+// breakpoint address is fetched. A fused pair is one instruction to the stub:
+// a breakpoint on its second half stops at the first, and a single step
+// runs both.
+
+#define GDB_PACKET_SIZE 4096
+#define GDB_MAX_BREAKPOINTS 64
+
+typedef struct {
+    socket_t sock;
+    int      breakpoint_pcs[GDB_MAX_BREAKPOINTS];
+    int      breakpoint_count;
+} GdbStub;
+
+static const char gdb_target_xml[] =
+    "<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+    "<target version=\"1.0\"><architecture>riscv:rv32</architecture>"
+    "<feature name=\"org.gnu.gdb.riscv.cpu\">"
+    "<reg name=\"zero\" bitsize=\"32\" type=\"int\" regnum=\"0\"/>"
+    "<reg name=\"x1\" bitsize=\"32\" type=\"int\"/><reg name=\"x2\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"x3\" bitsize=\"32\" type=\"int\"/><reg name=\"x4\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"x5\" bitsize=\"32\" type=\"int\"/><reg name=\"x6\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"x7\" bitsize=\"32\" type=\"int\"/><reg name=\"x8\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"x9\" bitsize=\"32\" type=\"int\"/><reg name=\"x10\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"x11\" bitsize=\"32\" type=\"int\"/><reg name=\"x12\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"x13\" bitsize=\"32\" type=\"int\"/><reg name=\"x14\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"x15\" bitsize=\"32\" type=\"int\"/><reg name=\"x16\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"x17\" bitsize=\"32\" type=\"int\"/><reg name=\"x18\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"x19\" bitsize=\"32\" type=\"int\"/><reg name=\"x20\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"x21\" bitsize=\"32\" type=\"int\"/><reg name=\"x22\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"x23\" bitsize=\"32\" type=\"int\"/><reg name=\"x24\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"x25\" bitsize=\"32\" type=\"int\"/><reg name=\"x26\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"x27\" bitsize=\"32\" type=\"int\"/><reg name=\"x28\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"x29\" bitsize=\"32\" type=\"int\"/><reg name=\"x30\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"x31\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/>"
+    "</feature></target>";
+
+static const char gdb_hex_digits[] = "0123456789abcdef";
+
+int gdb_hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// True if text starts with count hex digits. Stops at the terminating NUL,
+// so a short packet fails instead of being read past its end.
+bool gdb_is_hex(const char* text, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (gdb_hex_value(text[i]) < 0) return false;
+    }
+    return true;
+}
+
+// Appends a 32-bit value as 8 hex digits in target (little endian) byte order.
+char* gdb_put_word(char* out, uint32_t value) {
+    for (int b = 0; b < 4; b++) {
+        uint8_t byte = (value >> (8 * b)) & 0xFF;
+        *out++ = gdb_hex_digits[byte >> 4];
+        *out++ = gdb_hex_digits[byte & 0xF];
+    }
+    return out;
+}
+
+uint32_t gdb_get_word(const char* in) {
+    uint32_t value = 0;
+    for (int b = 0; b < 4; b++) {
+        value |= (uint32_t)((gdb_hex_value(in[2 * b]) << 4) | gdb_hex_value(in[2 * b + 1])) << (8 * b);
+    }
+    return value;
+}
+
+bool gdb_read_byte(GdbStub* stub, char* c) {
+    return recv(stub->sock, c, 1, 0) == 1;
+}
+
+// Reads one "$payload#xx" packet, acknowledging it. Returns the payload
+// length, -1 on disconnect, or -2 for a Ctrl-C interrupt byte.
+int gdb_get_packet(GdbStub* stub, char* buf) {
+    char c;
+    for (;;) {
+        do {
+            if (!gdb_read_byte(stub, &c)) return -1;
+            if (c == 0x03) return -2;
+        } while (c != '$');
+
+        int len = 0;
+        uint8_t checksum = 0;
+        while (gdb_read_byte(stub, &c) && c != '#') {
+            if (len < GDB_PACKET_SIZE - 1) buf[len++] = c;
+            checksum += (uint8_t)c;
+        }
+        char sum_hex[2];
+        if (!gdb_read_byte(stub, &sum_hex[0]) || !gdb_read_byte(stub, &sum_hex[1])) return -1;
+        buf[len] = '\0';
+        if (((gdb_hex_value(sum_hex[0]) << 4) | gdb_hex_value(sum_hex[1])) == checksum) {
+            send(stub->sock, "+", 1, 0);
+            return len;
+        }
+        send(stub->sock, "-", 1, 0);
+    }
+}
+
+void gdb_put_packet(GdbStub* stub, const char* payload) {
+    static char frame[GDB_PACKET_SIZE * 2 + 4];
+    uint8_t checksum = 0;
+    int n = 0;
+    frame[n++] = '$';
+    for (const char* p = payload; *p; p++) {
+        frame[n++] = *p;
+        checksum += (uint8_t)*p;
+    }
+    frame[n++] = '#';
+    frame[n++] = gdb_hex_digits[checksum >> 4];
+    frame[n++] = gdb_hex_digits[checksum & 0xF];
+    send(stub->sock, frame, n, 0);
+
+    char ack;
+    do {
+        if (!gdb_read_byte(stub, &ack)) return;
+    } while (ack != '+' && ack != '-');
+}
+
+bool gdb_interrupt_pending(GdbStub* stub) {
+    fd_set fds;
+    struct timeval no_wait = {0, 0};
+    FD_ZERO(&fds);
+    FD_SET(stub->sock, &fds);
+    if (select((int)stub->sock + 1, &fds, NULL, NULL, &no_wait) <= 0) return false;
+    char c;
+    return recv(stub->sock, &c, 1, 0) == 1 && c == 0x03;
+}
+
+bool gdb_is_breakpoint(GdbStub* stub, int pc) {
+    for (int i = 0; i < stub->breakpoint_count; i++) {
+        if (stub->breakpoint_pcs[i] == pc) return true;
+    }
+    return false;
+}
+
+// True if IF has the port in the coming cycle and the instruction it would
+// fetch there is a breakpoint. With fusion on, a pair at PC is fetched as one
+// micro-op, so a breakpoint on its second instruction stops here as well.
+// Whether IF then actually fetches (ID may be busy, a branch may redirect)
+// is only known once the cycle runs.
+bool gdb_fetch_due_at_breakpoint(GdbStub* stub) {
+    if (!IF_port_cycle(current_cycle + 1) || stall_IF_for_mem_after_branch) return false;
+    return gdb_is_breakpoint(stub, PC) ||
+           (fusion_at(memory, PC, instructions_loaded_count) != FUSION_NONE && gdb_is_breakpoint(stub, PC + 1));
+}
+
+// Runs with tracing off. single_step stops after the next instruction fetch.
+// A breakpoint at the resume PC is not reported again until that instruction
+// has been fetched. Writes the stop reply into reply.
+void gdb_resume(GdbStub* stub, bool single_step, char* reply) {
+    int32_t resume_pc = PC;
+    long cycles_run = 0;
+    while (!halt_simulation) {
+        if (PC != resume_pc && gdb_fetch_due_at_breakpoint(stub)) {
+            strcpy(reply, "T05swbreak:;");
+            return;
+        }
+        simulate_clock_cycle();
+        if (fetched_pc_this_cycle >= 0) {
+            if (single_step) {
+                strcpy(reply, "S05");
+                return;
+            }
+            resume_pc = -1;
+        }
+        if ((++cycles_run & 0xFFF) == 0 && gdb_interrupt_pending(stub)) {
+            strcpy(reply, "S02");
+            return;
+        }
+    }
+    strcpy(reply, "W00");
+}
+
+void gdb_read_memory(const char* args, char* reply) {
+    unsigned long addr = 0, len = 0;
+    if (sscanf(args, "%lx,%lx", &addr, &len) != 2 || addr + len > (unsigned long)MEMORY_SIZE * 4 ||
+        len > GDB_PACKET_SIZE / 2 - 1) {
+        strcpy(reply, "E01");
+        return;
+    }
+    char* out = reply;
+    for (unsigned long a = addr; a < addr + len; a++) {
+        uint8_t byte = (memory[a / 4] >> (8 * (a % 4))) & 0xFF;
+        *out++ = gdb_hex_digits[byte >> 4];
+        *out++ = gdb_hex_digits[byte & 0xF];
+    }
+    *out = '\0';
+}
+
+void gdb_write_memory(const char* args, char* reply) {
+    unsigned long addr = 0, len = 0;
+    const char* data = strchr(args, ':');
+    if (data == NULL || sscanf(args, "%lx,%lx", &addr, &len) != 2 || addr + len > (unsigned long)MEMORY_SIZE * 4) {
+        strcpy(reply, "E01");
+        return;
+    }
+    data++;
+    if (!gdb_is_hex(data, 2 * len)) {
+        strcpy(reply, "E01");
+        return;
+    }
+    for (unsigned long i = 0; i < len; i++) {
+        unsigned long a = addr + i;
+        uint32_t byte = (uint32_t)((gdb_hex_value(data[2 * i]) << 4) | gdb_hex_value(data[2 * i + 1]));
+        memory[a / 4] = (memory[a / 4] & ~(0xFFu << (8 * (a % 4)))) | (byte << (8 * (a % 4)));
+        mark_page_dirty((int)(a / 4));
+    }
+    strcpy(reply, "OK");
+}
+
+void gdb_handle_breakpoint(GdbStub* stub, const char* packet, char* reply) {
+    unsigned long addr = 0;
+    if (packet[1] != '0' || sscanf(packet + 3, "%lx", &addr) != 1) {
+        reply[0] = '\0'; // Only software breakpoints are supported
+        return;
+    }
+    int pc = (int)(addr / 4);
+    if (packet[0] == 'Z') {
+        if (!gdb_is_breakpoint(stub, pc)) {
+            if (stub->breakpoint_count == GDB_MAX_BREAKPOINTS) {
+                strcpy(reply, "E02");
+                return;
+            }
+            stub->breakpoint_pcs[stub->breakpoint_count++] = pc;
+        }
+    } else {
+        for (int i = 0; i < stub->breakpoint_count; i++) {
+            if (stub->breakpoint_pcs[i] == pc) {
+                stub->breakpoint_pcs[i] = stub->breakpoint_pcs[--stub->breakpoint_count];
+                break;
+            }
+        }
+    }
+    strcpy(reply, "OK");
+}
+
+void gdb_handle_xfer(const char* packet, char* reply) {
+    unsigned long offset = 0, length = 0;
+    const char* args = packet + strlen("qXfer:features:read:target.xml:");
+    if (strncmp(packet, "qXfer:features:read:target.xml:", strlen("qXfer:features:read:target.xml:")) != 0 ||
+        sscanf(args, "%lx,%lx", &offset, &length) != 2) {
+        reply[0] = '\0';
+        return;
+    }
+    unsigned long total = sizeof(gdb_target_xml) - 1;
+    if (offset >= total) {
+        strcpy(reply, "l");
+        return;
+    }
+    if (length > GDB_PACKET_SIZE - 2) length = GDB_PACKET_SIZE - 2;
+    unsigned long n = total - offset < length ? total - offset : length;
+    reply[0] = (offset + n < total) ? 'm' : 'l';
+    memcpy(reply + 1, gdb_target_xml + offset, n);
+    reply[n + 1] = '\0';
+}
+
+// Serves one GDB session on 127.0.0.1:port until the program exits, GDB
+// kills it or the connection drops.
+int run_gdb_server(const char* program_file, int port) {
+    static char packet[GDB_PACKET_SIZE];
+    static char reply[GDB_PACKET_SIZE * 2];
+    GdbStub stub = {0};
+
+#ifdef _WIN32
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+    initialize_processor();
+    if (program_file != NULL) load_assembly_file(program_file);
+    trace_enabled = false;
+
+    socket_t listener = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 1) != 0) {
+        printf("Error: cannot listen on 127.0.0.1:%d\n", port);
+        close_socket(listener);
+        return 1;
+    }
+    printf("GDB server listening on 127.0.0.1:%d (target remote :%d)\n", port, port);
+    fflush(stdout);
+    stub.sock = accept(listener, NULL, NULL);
+    close_socket(listener);
+    printf("GDB connected.\n");
+
+    for (;;) {
+        int len = gdb_get_packet(&stub, packet);
+        if (len == -1) break;
+        if (len == -2) continue; // Interrupt while already stopped
+        reply[0] = '\0';
+
+        switch (packet[0]) {
+            case '?':
+                strcpy(reply, halt_simulation ? "W00" : "S05");
+                break;
+            case 'g': {
+                char* out = reply;
+                for (int r = 0; r < NUM_REGISTERS; r++) out = gdb_put_word(out, (uint32_t)registers[r]);
+                out = gdb_put_word(out, (uint32_t)PC * 4);
+                *out = '\0';
+                break;
+            }
+            case 'G':
+                if (len < (NUM_REGISTERS + 1) * 8 + 1 || !gdb_is_hex(packet + 1, (NUM_REGISTERS + 1) * 8)) {
+                    strcpy(reply, "E01");
+                    break;
+                }
+                for (int r = 1; r < NUM_REGISTERS; r++) registers[r] = (int32_t)gdb_get_word(packet + 1 + r * 8);
+                PC = (int32_t)(gdb_get_word(packet + 1 + NUM_REGISTERS * 8) / 4);
+                strcpy(reply, "OK");
+                break;
+            case 'p': {
+                unsigned long r = strtoul(packet + 1, NULL, 16);
+                if (r < NUM_REGISTERS) {
+                    *gdb_put_word(reply, (uint32_t)registers[r]) = '\0';
+                } else if (r == NUM_REGISTERS) {
+                    *gdb_put_word(reply, (uint32_t)PC * 4) = '\0';
+                } else {
+                    strcpy(reply, "E01");
+                }
+                break;
+            }
+            case 'P': {
+                char* eq = strchr(packet, '=');
+                unsigned long r = strtoul(packet + 1, NULL, 16);
+                if (eq == NULL || r > NUM_REGISTERS || !gdb_is_hex(eq + 1, 8)) {
+                    strcpy(reply, "E01");
+                } else {
+                    uint32_t value = gdb_get_word(eq + 1);
+                    if (r == NUM_REGISTERS) PC = (int32_t)(value / 4);
+                    else if (r != 0) registers[r] = (int32_t)value;
+                    strcpy(reply, "OK");
+                }
+                break;
+            }
+            case 'm':
+                gdb_read_memory(packet + 1, reply);
+                break;
+            case 'M':
+                gdb_write_memory(packet + 1, reply);
+                break;
+            case 'c':
+                gdb_resume(&stub, false, reply);
+                break;
+            case 's':
+                gdb_resume(&stub, true, reply);
+                break;
+            case 'Z': case 'z':
+                gdb_handle_breakpoint(&stub, packet, reply);
+                break;
+            case 'H':
+                strcpy(reply, "OK");
+                break;
+            case 'k':
+                close_socket(stub.sock);
+                return 0;
+            case 'D':
+                gdb_put_packet(&stub, "OK");
+                close_socket(stub.sock);
+                return 0;
+            case 'q':
+                if (strncmp(packet, "qSupported", 10) == 0) {
+                    snprintf(reply, GDB_PACKET_SIZE, "PacketSize=%x;qXfer:features:read+;swbreak+", GDB_PACKET_SIZE);
+                } else if (strncmp(packet, "qXfer:", 6) == 0) {
+                    gdb_handle_xfer(packet, reply);
+                } else if (strcmp(packet, "qAttached") == 0) {
+                    strcpy(reply, "1");
+                } else if (strcmp(packet, "qC") == 0) {
+                    strcpy(reply, "QC1");
+                } else if (strcmp(packet, "qfThreadInfo") == 0) {
+                    strcpy(reply, "m1");
+                } else if (strcmp(packet, "qsThreadInfo") == 0) {
+                    strcpy(reply, "l");
+                }
+                break;
+            default:
+                break; // Empty reply: unsupported
+        }
+        gdb_put_packet(&stub, reply);
+        if (reply[0] == 'W') break;
+    }
+    close_socket(stub.sock);
+    printf("GDB session ended after %d cycles.\n", current_cycle);
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////// multi-core //////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define CORE_ID_REGISTER 31 // Each core starts with its index in R31
+
+typedef struct {
+    int         core_id;
+    const char* program_file;
+    int         max_cycles;
+    // Results, copied out of the thread-local machine before the thread exits
+    int32_t     registers[NUM_REGISTERS];
+    int32_t     PC;
+    int         cycles;
+    long        retired;
+    int         halt_reason;
+} CoreRun;
+
+int  multicore_quantum = 1000;
+bool multicore_deterministic = false;
+bool core_halted[MAX_CORES];
+pthread_barrier_t quantum_barrier;
+pthread_mutex_t turn_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  turn_changed = PTHREAD_COND_INITIALIZER;
+int current_turn = 0;
+
+// Deterministic mode: cores take turns in index order, one cycle each, so
+// every run interleaves shared-memory accesses identically.
+void run_one_cycle_in_turn(int core_id) {
+    pthread_mutex_lock(&turn_lock);
+    while (current_turn != core_id) pthread_cond_wait(&turn_changed, &turn_lock);
+    pthread_mutex_unlock(&turn_lock);
+
+    if (!halt_simulation) simulate_clock_cycle();
+
+    pthread_mutex_lock(&turn_lock);
+    current_turn = (current_turn + 1) % num_cores;
+    pthread_cond_broadcast(&turn_changed);
+    pthread_mutex_unlock(&turn_lock);
+}
+
+void* core_thread(void* arg) {
+    CoreRun* run = (CoreRun*)arg;
+    current_core_id = run->core_id;
+    trace_enabled = false;
+    pipeline_config = configured_pipeline;
+    initialize_processor();
+    load_assembly_file(run->program_file);
+    registers[CORE_ID_REGISTER] = run->core_id;
+    cycle_limit = run->max_cycles;
+    if (run->core_id == 0) {
+        // Core 0's image provides the initial contents of shared data memory.
+        memcpy(&shared_data_memory[DATA_MEM_START], &memory[DATA_MEM_START],
+               (MEMORY_SIZE - DATA_MEM_START) * sizeof(uint32_t));
+    }
+    pthread_barrier_wait(&quantum_barrier);
+
+    for (;;) {
+        if (multicore_deterministic) {
+            run_one_cycle_in_turn(run->core_id);
+        } else {
+            for (int n = 0; n < multicore_quantum && !halt_simulation; n++) simulate_clock_cycle();
+        }
+        core_halted[run->core_id] = halt_simulation != 0;
+        pthread_barrier_wait(&quantum_barrier);
+        bool all_halted = true;
+        for (int c = 0; c < num_cores; c++) all_halted = all_halted && core_halted[c];
+        pthread_barrier_wait(&quantum_barrier); // Everyone has read core_halted
+        if (all_halted) break;
+    }
+
+    memcpy(run->registers, registers, sizeof(registers));
+    run->PC = PC;
+    run->cycles = current_cycle;
+    run->retired = instructions_retired;
+    run->halt_reason = halt_simulation;
+    host_profile_merge();
+    return NULL;
+}
+
+// Core i runs program_files[i % num_files].
+int run_multicore(int cores, const char** program_files, int num_files, int max_cycles) {
+    static CoreRun runs[MAX_CORES];
+    pthread_t threads[MAX_CORES];
+    uint32_t initial_shared[MEMORY_SIZE];
+    struct timespec t0, t1;
+
+    if (num_files == 0) {
+        printf("Error: --cores needs at least one program file\n");
+        return 1;
+    }
+    if (cores > MAX_CORES) cores = MAX_CORES;
+    num_cores = cores;
+    multicore_enabled = true;
+    memset(core_caches, 0, sizeof(core_caches));
+    pthread_barrier_init(&quantum_barrier, NULL, cores);
+
+    printf("\n--- Starting %d-core Simulation (%s, quantum %d) ---\n", cores,
+           multicore_deterministic ? "deterministic" : "parallel", multicore_deterministic ? 1 : multicore_quantum);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int c = 0; c < cores; c++) {
+        runs[c] = (CoreRun){.core_id = c, .program_file = program_files[c % num_files], .max_cycles = max_cycles};
+        pthread_create(&threads[c], NULL, core_thread, &runs[c]);
+    }
+    for (int c = 0; c < cores; c++) pthread_join(threads[c], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    pthread_barrier_destroy(&quantum_barrier);
+
+    // Only core 0's image was copied in; recover it for the diff, then flush.
+    memset(initial_shared, 0, sizeof(initial_shared));
+    initialize_processor();
+    load_assembly_file(program_files[0]);
+    memcpy(&initial_shared[DATA_MEM_START], &memory[DATA_MEM_START], (MEMORY_SIZE - DATA_MEM_START) * sizeof(uint32_t));
+    for (int c = 0; c < cores; c++) {
+        for (int l = 0; l < CACHE_NUM_LINES; l++) {
+            if (core_caches[c].lines[l].state == LINE_MODIFIED) write_back_line(&core_caches[c], &core_caches[c].lines[l]);
+        }
+    }
+
+    double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("\n--- Simulation Ended (%.3f s host time) ---\n", seconds);
+    for (int c = 0; c < cores; c++) {
+        CoreRun* r = &runs[c];
+        printf("Core %d (%s): %d cycles, %ld retired, PC %d%s\n", c, r->program_file, r->cycles, r->retired, r->PC,
+               r->halt_reason == HALT_CYCLE_LIMIT ? " [cycle limit]" : "");
+        for (int i = 0; i < NUM_REGISTERS; i++) {
+            if (r->registers[i] != 0) printf("  R%02d: %d\n", i, r->registers[i]);
+        }
+        printf("  Cache: %ld hits, %ld misses, %ld invalidations, %ld writebacks\n", core_caches[c].hits,
+               core_caches[c].misses, core_caches[c].invalidations, core_caches[c].writebacks);
+    }
+    printf("\nShared Data Memory changes:\n");
+    for (int a = DATA_MEM_START; a < MEMORY_SIZE; a++) {
+        if (shared_data_memory[a] != initial_shared[a]) {
+            printf("Mem[%04d]: %10d -> %10d\n", a, (int32_t)initial_shared[a], (int32_t)shared_data_memory[a]);
+        }
+    }
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////// lockstep lanes /////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Functional (untimed) engine that runs one program over many initial data
+// sets at once. SIMD_LANES instances are kept in structure-of-arrays form so
+// each opcode is a fixed-length, branch-free loop over lanes that the
+// compiler turns into SSE/AVX code. Lanes diverge freely on BNE: every step
+// executes the lowest PC among live lanes, with the other lanes masked off,
+// so they reconverge as soon as their PCs meet again. Semantics match
+// reference_run, vector instructions included (each lane has its own vector
+// registers, --vlen elements long).
+#define SIMD_LANES      16
+#define DATA_WORDS      (MEMORY_SIZE - DATA_MEM_START)
+#define LANE_MAX_STEPS  1000000
+#define MAX_INSTANCES   4096
+
+typedef struct {
+    int32_t regs[NUM_REGISTERS][SIMD_LANES];
+    int32_t data[DATA_WORDS][SIMD_LANES];
+    int32_t vregs[NUM_VECTOR_REGISTERS][MAX_VECTOR_LENGTH][SIMD_LANES];
+    int32_t pc[SIMD_LANES];
+    int32_t live[SIMD_LANES]; // -1 while the lane still runs, else 0
+    long    steps[SIMD_LANES];
+} LaneGroup;
+
+// Selects new where mask is all-ones, keeps old where it is zero.
+#define LANE_BLEND(mask, new_val, old_val) (((new_val) & (mask)) | ((old_val) & ~(mask)))
+
+void lane_group_step(LaneGroup* g, int program_length, int32_t pc) {
+    int32_t mask[SIMD_LANES];
+    for (int l = 0; l < SIMD_LANES; l++) mask[l] = g->live[l] & -(int32_t)(g->pc[l] == pc);
+
+    uint32_t instr = memory[pc];
+    uint8_t  opcode = (instr >> 28) & 0xF;
+    int r1 = (instr >> 23) & 0x1F, r2 = (instr >> 18) & 0x1F, r3 = (instr >> 13) & 0x1F;
+    int vlen = pipeline_config.vector_length;
+    uint32_t shamt = instr & 0x1FFF;
+    int32_t  imm = instr & 0x3FFFF;
+    if (imm & (1 << 17)) imm |= ~0x3FFFF;
+    const int32_t* a = g->regs[r2];
+    const int32_t* b = g->regs[r3];
+    int32_t result[SIMD_LANES];
+    int32_t next[SIMD_LANES];
+    bool writes_r1 = true;
+    for (int l = 0; l < SIMD_LANES; l++) next[l] = pc + 1;
+
+    switch (opcode) {
+        case OPCODE_ADD:  for (int l = 0; l < SIMD_LANES; l++) result[l] = (int32_t)((uint32_t)a[l] + (uint32_t)b[l]); break;
+        case OPCODE_SUB:  for (int l = 0; l < SIMD_LANES; l++) result[l] = (int32_t)((uint32_t)a[l] - (uint32_t)b[l]); break;
+        case OPCODE_MULI: for (int l = 0; l < SIMD_LANES; l++) result[l] = (int32_t)((uint32_t)a[l] * (uint32_t)imm);  break;
+        case OPCODE_ADDI: for (int l = 0; l < SIMD_LANES; l++) result[l] = (int32_t)((uint32_t)a[l] + (uint32_t)imm);  break;
+        case OPCODE_ANDI: for (int l = 0; l < SIMD_LANES; l++) result[l] = a[l] & imm; break;
+        case OPCODE_ORI:  for (int l = 0; l < SIMD_LANES; l++) result[l] = a[l] | imm; break;
+        case OPCODE_SLL:  for (int l = 0; l < SIMD_LANES; l++) result[l] = (int32_t)((uint32_t)a[l] << (shamt & 31)) & -(int32_t)(shamt < 32); break;
+        case OPCODE_SRL:  for (int l = 0; l < SIMD_LANES; l++) result[l] = (int32_t)((uint32_t)a[l] >> (shamt & 31)) & -(int32_t)(shamt < 32); break;
+        case OPCODE_BNE:
+            writes_r1 = false;
+            for (int l = 0; l < SIMD_LANES; l++) next[l] = g->regs[r1][l] != a[l] ? pc + 1 + imm : pc + 1;
+            break;
+        case OPCODE_J:
+            writes_r1 = false;
+            for (int l = 0; l < SIMD_LANES; l++) next[l] = (int32_t)(((uint32_t)(pc + 1) & 0xF0000000) | (instr & 0x0FFFFFFF));
+            break;
+        case OPCODE_LW:
+            // Per-lane addresses: a gather, done as a scalar loop.
+            for (int l = 0; l < SIMD_LANES; l++) {
+                int32_t ea = (int32_t)((uint32_t)a[l] + (uint32_t)imm);
+                result[l] = (ea >= DATA_MEM_START && ea < MEMORY_SIZE) ? g->data[ea - DATA_MEM_START][l] : 0;
+            }
+            break;
+        case OPCODE_SW:
+            writes_r1 = false;
+            for (int l = 0; l < SIMD_LANES; l++) {
+                if (!mask[l]) continue;
+                int32_t ea = (int32_t)((uint32_t)a[l] + (uint32_t)imm);
+                if (ea >= DATA_MEM_START && ea < MEMORY_SIZE) g->data[ea - DATA_MEM_START][l] = g->regs[r1][l];
+            }
+            break;
+        case OPCODE_VMEM: {
+            // Per-lane base addresses again: element-wise gather/scatter.
+            int32_t offset = instr & 0x1FFFF;
+            if (offset & (1 << 16)) offset |= ~0x1FFFF;
+            int32_t (*v)[SIMD_LANES] = g->vregs[r1 & 7];
+            writes_r1 = false;
+            for (int l = 0; l < SIMD_LANES; l++) {
+                if (!mask[l]) continue;
+                int32_t ea = (int32_t)((uint32_t)a[l] + (uint32_t)offset);
+                for (int e = 0; e < vlen; e++) {
+                    bool in_data = ea + e >= DATA_MEM_START && ea + e < MEMORY_SIZE;
+                    if (instr & VMEM_STORE_BIT) {
+                        if (in_data) g->data[ea + e - DATA_MEM_START][l] = v[e][l];
+                    } else {
+                        v[e][l] = in_data ? g->data[ea + e - DATA_MEM_START][l] : 0;
+                    }
+                }
+            }
+            break;
+        }
+        case OPCODE_VALU:
+            writes_r1 = false;
+            for (int e = 0; e < vlen; e++) {
+                const int32_t* x = g->vregs[r2 & 7][e];
+                const int32_t* y = g->vregs[r3 & 7][e];
+                int32_t* d = g->vregs[r1 & 7][e];
+                for (int l = 0; l < SIMD_LANES; l++) {
+                    int32_t value = (int32_t)((instr & VALU_SUB_BIT) ? (uint32_t)x[l] - (uint32_t)y[l]
+                                                                     : (uint32_t)x[l] + (uint32_t)y[l]);
+                    d[l] = LANE_BLEND(mask[l], value, d[l]);
+                }
+            }
+            break;
+        case OPCODE_VSUM:
+            for (int l = 0; l < SIMD_LANES; l++) result[l] = 0;
+            for (int e = 0; e < vlen; e++) {
+                const int32_t* x = g->vregs[r2 & 7][e];
+                for (int l = 0; l < SIMD_LANES; l++) result[l] = (int32_t)((uint32_t)result[l] + (uint32_t)x[l]);
+            }
+            break;
+        default: // NOP and unassigned opcodes
+            writes_r1 = false;
+            break;
+    }
+
+    if (writes_r1 && r1 != 0) {
+        int32_t* d = g->regs[r1];
+        for (int l = 0; l < SIMD_LANES; l++) d[l] = LANE_BLEND(mask[l], result[l], d[l]);
+    }
+    for (int l = 0; l < SIMD_LANES; l++) {
+        g->pc[l] = LANE_BLEND(mask[l], next[l], g->pc[l]);
+        g->steps[l] += mask[l] & 1;
+        int32_t running = -(int32_t)(g->pc[l] >= 0 && g->pc[l] < program_length && g->steps[l] < LANE_MAX_STEPS);
+        g->live[l] = LANE_BLEND(mask[l], running, g->live[l]);
+    }
+}
+
+// Runs every live lane to completion.
+void lane_group_run(LaneGroup* g, int program_length) {
+    for (;;) {
+        int32_t pc = INT_MAX;
+        for (int l = 0; l < SIMD_LANES; l++) {
+            if (g->live[l] && g->pc[l] < pc) pc = g->pc[l];
+        }
+        if (pc == INT_MAX) return;
+        lane_group_step(g, program_length, pc);
+    }
+}
+
+typedef struct {
+    int     num_settings;
+    int     addresses[64]; // Register index (negative: -1 - reg) or data address
+    int32_t values[64];
+} LaneInstance;
+
+// One instance per non-empty line: space-separated "R<n>=<value>" or
+// "<address>=<value>" settings applied on top of the program's image.
+int load_lane_instances(const char* filename, LaneInstance* instances) {
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        printf("Error opening file: %s\n", filename);
+        exit(1);
+    }
+    char line[4096];
+    int count = 0;
+    while (fgets(line, sizeof(line), file) != NULL && count < MAX_INSTANCES) {
+        char* hash = strchr(line, '#');
+        if (hash != NULL) *hash = '\0';
+        LaneInstance* inst = &instances[count];
+        inst->num_settings = 0;
+        for (char* token = strtok(line, " \t\r\n"); token != NULL; token = strtok(NULL, " \t\r\n")) {
+            char* eq = strchr(token, '=');
+            if (eq == NULL || inst->num_settings == 64) {
+                printf("Invalid instance setting: %s\n", token);
+                exit(1);
+            }
+            *eq = '\0';
+            int target;
+            if (token[0] == 'R') {
+                target = -1 - parse_register(token);
+            } else {
+                target = atoi(token);
+                if (target < DATA_MEM_START || target >= MEMORY_SIZE) {
+                    printf("Instance address out of data memory: %s\n", token);
+                    exit(1);
+                }
+            }
+            inst->addresses[inst->num_settings] = target;
+            inst->values[inst->num_settings++] = atoi(eq + 1);
+        }
+        if (inst->num_settings > 0) count++;
+    }
+    fclose(file);
+    return count;
+}
+
+int run_lockstep_lanes(const char* program_file, const char* instances_file) {
+    static LaneInstance instances[MAX_INSTANCES];
+    LaneGroup* g = malloc(sizeof(LaneGroup));
+    struct timespec t0, t1;
+    long total_steps = 0;
+
+    initialize_processor();
+    load_assembly_file(program_file);
+    int n = load_lane_instances(instances_file, instances);
+    int program_length = instructions_loaded_count;
+    printf("Running %d instances in groups of %d lanes\n", n, SIMD_LANES);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int base = 0; base < n; base += SIMD_LANES) {
+        memset(g, 0, sizeof(LaneGroup));
+        for (int l = 0; l < SIMD_LANES; l++) {
+            for (int w = 0; w < DATA_WORDS; w++) g->data[w][l] = (int32_t)memory[DATA_MEM_START + w];
+            if (base + l >= n) continue;
+            LaneInstance* inst = &instances[base + l];
+            for (int s = 0; s < inst->num_settings; s++) {
+                if (inst->addresses[s] < 0) g->regs[-1 - inst->addresses[s]][l] = inst->values[s];
+                else g->data[inst->addresses[s] - DATA_MEM_START][l] = inst->values[s];
+            }
+            g->regs[0][l] = 0;
+            g->live[l] = program_length > 0 ? -1 : 0;
+        }
+        lane_group_run(g, program_length);
+
+        for (int l = 0; l < SIMD_LANES && base + l < n; l++) {
+            total_steps += g->steps[l];
+            printf("Instance %d: %ld instructions%s", base + l, g->steps[l],
+                   g->steps[l] >= LANE_MAX_STEPS ? " [step limit]" : (g->pc[l] < 0 ? " [PC out of range]" : ""));
+            for (int r = 1; r < NUM_REGISTERS; r++) {
+                if (g->regs[r][l] != 0) printf(" R%d=%d", r, g->regs[r][l]);
+            }
+            for (int w = 0; w < DATA_WORDS; w++) {
+                if (g->data[w][l] != (int32_t)memory[DATA_MEM_START + w]) printf(" Mem[%d]=%d", DATA_MEM_START + w, g->data[w][l]);
+            }
+            printf("\n");
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    free(g);
+
+    double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("Executed %ld instructions over %d instances in %.3f s (%.1f M instructions/s)\n",
+           total_steps, n, seconds, seconds > 0 ? total_steps / seconds / 1e6 : 0.0);
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////// design-space exploration /////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// --sweep runs every point of a parameter grid against every program on a
+// thread pool and prints a CPI table. Grid file: one parameter per line
+// followed by the values to try, '#' starts a comment:
+//
+//     memory_port  shared split
+//     id_latency   2
+//     ex_latency   1 2 3
+//     forwarding   on off
+//     branch       flush stall
+//     mem_latency  1 2
+//     fusion       off on
+//     store_buffer 0 4
+//
+// Parameters left out keep their --pipeline/--latency setting (or default),
+// so per-opcode latencies set there apply to every point. Every run is
+// checked against reference_run. With --replay each program is executed once
+// and every point is timed by replay_timing over its trace instead (same
+// cycle counts, no per-point state check); the first program of each
+// configuration is also run through the full pipeline, and a point whose
+// replay disagrees with it is reported as DRIFT. Results are cached by a hash of
+// the configuration and the loaded memory image, so growing a grid only
+// simulates the new points. SWEEP_MODEL_VERSION goes into that hash too:
+// bump it with any change to the timing model, or the cache keeps serving
+// cycle counts from the old one.
+#define SWEEP_NUM_PARAMETERS 8
+#define SWEEP_MAX_VALUES     8
+#define SWEEP_MAX_CONFIGS    4096
+#define SWEEP_MAX_PROGRAMS   16
+#define SWEEP_MAX_REF_STEPS  10000000
+#define SWEEP_CACHE_FILE     "sweep_cache.txt"
+#define SWEEP_MODEL_VERSION  1
+
+#define SWEEP_OK       0
+#define SWEEP_MISMATCH 1 // Final state differs from reference_run
+#define SWEEP_NO_HALT  2 // Pipeline did not drain within the cycle budget
+#define SWEEP_DRIFT    3 // replay_timing disagrees with the full pipeline
+
+static const char* sweep_status_names[] = {"OK", "MISMATCH", "NO-HALT", "DRIFT"};
+
+static const char* sweep_parameter_names[SWEEP_NUM_PARAMETERS] = {
+    "memory_port", "id_latency", "ex_latency", "forwarding", "branch", "mem_latency", "fusion",
+    "store_buffer"
+};
+
+static const char* ex_unit_names[NUM_EX_UNITS] = {"alu", "mul", "agu", "vector"};
+
+bool parse_pipeline_setting(PipelineConfig* config, const char* key, const char* value) {
+    if (strcmp(key, "memory_port") == 0) {
+        if (strcmp(value, "shared") == 0) config->split_memory_ports = false;
+        else if (strcmp(value, "split") == 0) config->split_memory_ports = true;
+        else return false;
+    } else if (strcmp(key, "id_latency") == 0 || strcmp(key, "ex_latency") == 0 || strcmp(key, "mem_latency") == 0) {
+        int latency = atoi(value);
+        if (latency < 1 || latency > MAX_STAGE_LATENCY) return false;
+        if (key[0] == 'i') config->id_latency = latency;
+        else if (key[0] == 'e') config->ex_latency = latency;
+        else config->mem_latency = latency;
+    } else if (strstr(key, "_unit") != NULL) {
+        int unit = 0;
+        size_t length = strlen(key) - strlen("_unit");
+        while (unit < NUM_EX_UNITS && (strlen(ex_unit_names[unit]) != length ||
+                                       strncmp(key, ex_unit_names[unit], length) != 0)) unit++;
+        if (unit == NUM_EX_UNITS || strcmp(key + length, "_unit") != 0) return false;
+        if (strcmp(value, "pipelined") == 0) config->unit_pipelined[unit] = true;
+        else if (strcmp(value, "blocking") == 0) config->unit_pipelined[unit] = false;
+        else return false;
+    } else if (strcmp(key, "forwarding") == 0) {
+        if (strcmp(value, "on") == 0) config->forwarding = true;
+        else if (strcmp(value, "off") == 0) config->forwarding = false;
+        else return false;
+    } else if (strcmp(key, "branch") == 0) {
+        if (strcmp(value, "flush") == 0) config->branch_policy = BRANCH_FLUSH;
+        else if (strcmp(value, "stall") == 0) config->branch_policy = BRANCH_STALL;
+        else return false;
+    } else if (strcmp(key, "fusion") == 0) {
+        if (strcmp(value, "on") == 0) config->fusion = true;
+        else if (strcmp(value, "off") == 0) config->fusion = false;
+        else return false;
+    } else if (strcmp(key, "store_buffer") == 0) {
+        int depth = atoi(value);
+        if (depth < 0 || depth > MAX_STORE_BUFFER_DEPTH) return false;
+        config->store_buffer_depth = depth;
+    } else if (strcmp(key, "vlen") == 0) {
+        int length = atoi(value);
+        if (length < 1 || length > MAX_VECTOR_LENGTH) return false;
+        config->vector_length = length;
+    } else {
+        // Opcode name (as printed by get_opcode_name): EX latency of that opcode
+        int opcode = 0;
+        while (opcode < NUM_OPCODES && strcmp(key, get_opcode_name(opcode)) != 0) opcode++;
+        int latency = atoi(value);
+        if (opcode == NUM_OPCODES || latency < 1 || latency > MAX_STAGE_LATENCY) return false;
+        config->opcode_ex_latency[opcode] = latency;
+    }
+    return true;
+}
+
+// --latency <file>: one "key value" setting per line, '#' starts a comment.
+// Takes the --pipeline keys plus an EX latency per opcode and a
+// pipelined/blocking choice per functional unit, e.g.
+//
+//     ex_latency   1          # opcodes not listed below
+//     MULI         4
+//     mul_unit     pipelined  # alu_unit, mul_unit, agu_unit, vector_unit
+//     mem_latency  3
+void load_latency_config(const char* filename, PipelineConfig* config) {
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        printf("Error opening file: %s\n", filename);
+        exit(1);
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char* comment = strchr(line, '#');
+        if (comment != NULL) *comment = '\0';
+        char* key = strtok(line, " \t\r\n");
+        if (key == NULL) continue;
+        char* value = strtok(NULL, " \t\r\n");
+        if (value == NULL || !parse_pipeline_setting(config, key, value)) {
+            printf("Invalid latency setting: %s %s\n", key, value ? value : "");
+            exit(1);
+        }
+    }
+    fclose(file);
+}
+
+// --pipeline "key=value,key=value" (same keys as the sweep grid)
+void parse_pipeline_spec(const char* spec, PipelineConfig* config) {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "%s", spec);
+    for (char* item = strtok(buffer, ","); item != NULL; item = strtok(NULL, ",")) {
+        char* value = strchr(item, '=');
+        if (value != NULL) *value++ = '\0';
+        if (value == NULL || !parse_pipeline_setting(config, item, value)) {
+            printf("Invalid pipeline setting: %s\n", item);
+            exit(1);
+        }
+    }
+}
+
+void describe_pipeline_config(const PipelineConfig* config, char* buf, size_t size) {
+    char store_buffer[16] = "";
+    if (config->store_buffer_depth > 0) snprintf(store_buffer, sizeof(store_buffer), " sb=%d", config->store_buffer_depth);
+    snprintf(buf, size, "port=%-6s id=%d ex=%d fwd=%-3s branch=%-5s mem=%d%s%s",
+             config->split_memory_ports ? "split" : "shared", config->id_latency, config->ex_latency,
+             config->forwarding ? "on" : "off", config->branch_policy == BRANCH_STALL ? "stall" : "flush",
+             config->mem_latency, config->fusion ? " fused" : "", store_buffer);
+}
+
+uint64_t fnv1a_hash(uint64_t hash, const void* data, size_t size) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+#define FNV_OFFSET_BASIS 0xCBF29CE484222325ull
+
+uint64_t sweep_job_key(const PipelineConfig* config, uint64_t program_hash) {
+    int32_t fields[9 + NUM_OPCODES + NUM_EX_UNITS] = {config->split_memory_ports, config->id_latency, config->ex_latency,
+                                                      config->forwarding, config->branch_policy, config->vector_length,
+                                                      config->mem_latency, config->fusion, config->store_buffer_depth};
+    for (int op = 0; op < NUM_OPCODES; op++) fields[9 + op] = config->opcode_ex_latency[op];
+    for (int unit = 0; unit < NUM_EX_UNITS; unit++) fields[9 + NUM_OPCODES + unit] = config->unit_pipelined[unit];
+    int32_t model_version = SWEEP_MODEL_VERSION;
+    uint64_t hash = fnv1a_hash(FNV_OFFSET_BASIS, &model_version, sizeof(model_version));
+    return fnv1a_hash(fnv1a_hash(hash, fields, sizeof(fields)), &program_hash, sizeof(program_hash));
+}
+
+typedef struct {
+    const char* name;
+    uint32_t image[MEMORY_SIZE];            // Memory right after loading
+    int      length;
+    uint64_t hash;
+    long     reference_steps;
+    int32_t  reference_registers[NUM_REGISTERS];
+    uint32_t reference_memory[MEMORY_SIZE];
+    FunctionalTrace trace; // --replay only
+} SweepProgram;
+
+typedef struct {
+    uint64_t key;
+    long     cycles;
+    long     instructions;
+    int      status;
+    bool     cached;
+} SweepResult;
+
+typedef struct {
+    const PipelineConfig* configs;
+    const SweepProgram*   programs;
+    int          num_programs;
+    SweepResult* results; // [config * num_programs + program]
+    int          num_jobs;
+    int          next_job;
+    bool         replay;
+    pthread_mutex_t lock;
+} Sweep;
+
+int load_sweep_grid(const char* filename, PipelineConfig* configs) {
+    char values[SWEEP_NUM_PARAMETERS][SWEEP_MAX_VALUES][16];
+    int counts[SWEEP_NUM_PARAMETERS] = {0};
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        printf("Error opening file: %s\n", filename);
+        exit(1);
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char* comment = strchr(line, '#');
+        if (comment != NULL) *comment = '\0';
+        char* key = strtok(line, " \t\r\n");
+        if (key == NULL) continue;
+        int p = 0;
+        while (p < SWEEP_NUM_PARAMETERS && strcmp(key, sweep_parameter_names[p]) != 0) p++;
+        if (p == SWEEP_NUM_PARAMETERS) {
+            printf("Unknown sweep parameter: %s\n", key);
+            exit(1);
+        }
+        counts[p] = 0;
+        for (char* value = strtok(NULL, " \t\r\n"); value != NULL; value = strtok(NULL, " \t\r\n")) {
+            PipelineConfig scratch = configured_pipeline;
+            if (counts[p] == SWEEP_MAX_VALUES || !parse_pipeline_setting(&scratch, key, value)) {
+                printf("Invalid value for %s: %s\n", key, value);
+                exit(1);
+            }
+            snprintf(values[p][counts[p]++], sizeof(values[p][0]), "%s", value);
+        }
+    }
+    fclose(file);
+
+    // Cartesian product; the first parameter varies slowest
+    int total = 1;
+    for (int p = 0; p < SWEEP_NUM_PARAMETERS; p++) {
+        if (counts[p] > 0) total *= counts[p];
+    }
+    if (total > SWEEP_MAX_CONFIGS) {
+        printf("Sweep grid has %d points (limit %d)\n", total, SWEEP_MAX_CONFIGS);
+        exit(1);
+    }
+    for (int c = 0; c < total; c++) {
+        PipelineConfig config = configured_pipeline;
+        int rest = c;
+        for (int p = SWEEP_NUM_PARAMETERS - 1; p >= 0; p--) {
+            if (counts[p] == 0) continue;
+            parse_pipeline_setting(&config, sweep_parameter_names[p], values[p][rest % counts[p]]);
+            rest /= counts[p];
+        }
+        configs[c] = config;
+    }
+    return total;
+}
+
+int compare_sweep_results(const void* a, const void* b) {
+    uint64_t x = ((const SweepResult*)a)->key, y = ((const SweepResult*)b)->key;
+    return x < y ? -1 : x > y;
+}
+
+// Cache file lines: "<key hex> <cycles> <instructions> <status>"
+int load_sweep_cache(const char* filename, SweepResult** entries) {
+    int count = 0, capacity = 0;
+    *entries = NULL;
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) return 0;
+    SweepResult r = {0};
+    unsigned long long key;
+    while (fscanf(file, "%llx %ld %ld %d", &key, &r.cycles, &r.instructions, &r.status) == 4) {
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            *entries = realloc(*entries, capacity * sizeof(SweepResult));
+        }
+        r.key = key;
+        (*entries)[count++] = r;
+    }
+    fclose(file);
+    qsort(*entries, count, sizeof(SweepResult), compare_sweep_results);
+    return count;
+}
+
+void run_sweep_job(const PipelineConfig* config, const SweepProgram* program, SweepResult* result) {
+    pipeline_config = *config;
+    initialize_processor();
+    trace_enabled = false;
+    memcpy(memory, program->image, sizeof(memory));
+    instructions_loaded_count = program->length;
+    cycle_limit = (int)(program->reference_steps * 2 * pipeline_cycle_scale()) + 64;
+    while (!halt_simulation) {
+        skip_idle_cycles(LONG_MAX);
+        simulate_clock_cycle();
+    }
+
+    result->cycles = current_cycle;
+    result->instructions = instructions_retired;
+    result->status = SWEEP_OK;
+    if (halt_simulation != HALT_DRAINED) {
+        result->status = SWEEP_NO_HALT;
+    } else if (memcmp(registers, program->reference_registers, sizeof(registers)) != 0 ||
+               memcmp(&memory[DATA_MEM_START], &program->reference_memory[DATA_MEM_START],
+                      (MEMORY_SIZE - DATA_MEM_START) * sizeof(uint32_t)) != 0) {
+        result->status = SWEEP_MISMATCH;
+    }
+}
+
+// With cross_check, also runs the full pipeline and keeps its status, or
+// SWEEP_DRIFT if the two disagree on cycles or retired instructions.
+void replay_sweep_job(const PipelineConfig* config, const SweepProgram* program, SweepResult* result, bool cross_check) {
+    pipeline_config = *config;
+    ReplayResult replay = replay_timing(&program->trace, program->image, program->length,
+                                        program->reference_steps * 2 * pipeline_cycle_scale() + 64);
+    result->cycles = replay.cycles;
+    result->instructions = replay.retired;
+    result->status = replay.halt == HALT_DRAINED ? SWEEP_OK : SWEEP_NO_HALT;
+    if (!cross_check) return;
+
+    SweepResult full;
+    run_sweep_job(config, program, &full);
+    if (full.status != SWEEP_OK) {
+        result->status = full.status;
+    } else if (full.cycles != result->cycles || full.instructions != result->instructions) {
+        result->status = SWEEP_DRIFT;
+    }
+}
+
+void* sweep_worker(void* arg) {
+    Sweep* sweep = (Sweep*)arg;
+    for (;;) {
+        pthread_mutex_lock(&sweep->lock);
+        int job = sweep->next_job;
+        while (job < sweep->num_jobs && sweep->results[job].cached) job++;
+        sweep->next_job = job + 1;
+        pthread_mutex_unlock(&sweep->lock);
+        if (job >= sweep->num_jobs) break;
+        if (sweep->replay) {
+            // A cached first program was cross-checked when it was first run
+            replay_sweep_job(&sweep->configs[job / sweep->num_programs], &sweep->programs[job % sweep->num_programs],
+                             &sweep->results[job], job % sweep->num_programs == 0);
+        } else {
+            run_sweep_job(&sweep->configs[job / sweep->num_programs],
+                          &sweep->programs[job % sweep->num_programs], &sweep->results[job]);
+        }
+    }
+    host_profile_merge();
+    return NULL;
+}
+
+int run_sweep(const char* grid_file, const char** program_files, int num_programs,
+              int num_threads, const char* cache_file, bool replay) {
+    static PipelineConfig configs[SWEEP_MAX_CONFIGS];
+    int num_configs = load_sweep_grid(grid_file, configs);
+    if (num_programs < 1 || num_programs > SWEEP_MAX_PROGRAMS) {
+        printf("--sweep needs 1 to %d program files\n", SWEEP_MAX_PROGRAMS);
+        return 1;
+    }
+
+    SweepProgram* programs = calloc(num_programs, sizeof(SweepProgram));
+    for (int p = 0; p < num_programs; p++) {
+        SweepProgram* program = &programs[p];
+        initialize_processor();
+        load_assembly_file(program_files[p]);
+        const char* slash = strrchr(program_files[p], '/');
+        program->name = slash ? slash + 1 : program_files[p];
+        memcpy(program->image, memory, sizeof(memory));
+        program->length = instructions_loaded_count;
+        program->hash = fnv1a_hash(fnv1a_hash(FNV_OFFSET_BASIS, memory, sizeof(memory)),
+                                   &program->length, sizeof(program->length));
+        memcpy(program->reference_memory, memory, sizeof(memory));
+        program->reference_steps = reference_run(program->reference_memory, program->length, program->reference_registers,
+                                                 SWEEP_MAX_REF_STEPS, replay ? &program->trace : NULL);
+        if (program->reference_steps < 0) {
+            printf("%s does not terminate within %d instructions; not swept.\n", program->name, SWEEP_MAX_REF_STEPS);
+            for (int q = 0; q <= p; q++) free_functional_trace(&programs[q].trace);
+            free(programs);
+            return 1;
+        }
+    }
+
+    Sweep sweep = {.configs = configs, .programs = programs, .num_programs = num_programs,
+                   .num_jobs = num_configs * num_programs, .replay = replay};
+    sweep.results = calloc(sweep.num_jobs, sizeof(SweepResult));
+    SweepResult* cache;
+    int cache_count = load_sweep_cache(cache_file, &cache);
+    int cached_jobs = 0;
+    for (int j = 0; j < sweep.num_jobs; j++) {
+        SweepResult* r = &sweep.results[j];
+        r->key = sweep_job_key(&configs[j / num_programs], programs[j % num_programs].hash);
+        SweepResult* hit = cache_count ? bsearch(r, cache, cache_count, sizeof(SweepResult), compare_sweep_results) : NULL;
+        if (hit != NULL) {
+            *r = *hit;
+            r->cached = true;
+            cached_jobs++;
+        }
+    }
+    free(cache);
+
+    struct timespec t0, t1;
+    pthread_t threads[FUZZ_MAX_THREADS];
+    if (num_threads < 1) num_threads = 1;
+    if (num_threads > FUZZ_MAX_THREADS) num_threads = FUZZ_MAX_THREADS;
+    printf("Sweeping %d configurations x %d programs (%d cached), %d threads%s\n",
+           num_configs, num_programs, cached_jobs, num_threads, replay ? ", timing replay" : "");
+    pthread_mutex_init(&sweep.lock, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int t = 0; t < num_threads; t++) pthread_create(&threads[t], NULL, sweep_worker, &sweep);
+    for (int t = 0; t < num_threads; t++) pthread_join(threads[t], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    pthread_mutex_destroy(&sweep.lock);
+    double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    FILE* cache_out = fopen(cache_file, "a");
+    for (int j = 0; j < sweep.num_jobs && cache_out != NULL; j++) {
+        const SweepResult* r = &sweep.results[j];
+        if (!r->cached) fprintf(cache_out, "%016llx %ld %ld %d\n", (unsigned long long)r->key, r->cycles, r->instructions, r->status);
+    }
+    if (cache_out != NULL) fclose(cache_out);
+
+    // CPI per program, mean CPI over programs and aggregate IPC per configuration
+    char text[64];
+    int failures = 0, best = -1;
+    double best_cpi = 0;
+    printf("\n%-62s", "Configuration");
+    for (int p = 0; p < num_programs; p++) printf(" %10.10s", programs[p].name);
+    printf(" %9s %7s\n", "Mean CPI", "IPC");
+    for (int c = 0; c < num_configs; c++) {
+        describe_pipeline_config(&configs[c], text, sizeof(text));
+        printf("%-62s", text);
+        double cpi_sum = 0;
+        long cycles = 0, instructions = 0;
+        bool all_ok = true;
+        for (int p = 0; p < num_programs; p++) {
+            const SweepResult* r = &sweep.results[c * num_programs + p];
+            if (r->status != SWEEP_OK || r->instructions == 0) {
+                printf(" %10s", r->status != SWEEP_OK ? sweep_status_names[r->status] : "NO-HALT");
+                all_ok = false;
+                failures++;
+                continue;
+            }
+            double cpi = (double)r->cycles / r->instructions;
+            printf(" %10.3f", cpi);
+            cpi_sum += cpi;
+            cycles += r->cycles;
+            instructions += r->instructions;
+        }
+        if (all_ok) {
+            double mean = cpi_sum / num_programs;
+            printf(" %9.3f %7.3f\n", mean, (double)instructions / cycles);
+            if (best < 0 || mean < best_cpi) {
+                best = c;
+                best_cpi = mean;
+            }
+        } else {
+            printf(" %9s %7s\n", "-", "-");
+        }
+    }
+    if (best >= 0) {
+        describe_pipeline_config(&configs[best], text, sizeof(text));
+        printf("\nLowest mean CPI: %s (%.3f)\n", text, best_cpi);
+    }
+    printf("%d runs simulated in %.2f s, %d taken from %s\n",
+           sweep.num_jobs - cached_jobs, seconds, cached_jobs, cache_file);
+    free(sweep.results);
+    for (int p = 0; p < num_programs; p++) free_functional_trace(&programs[p].trace);
+    free(programs);
+    return failures ? 1 : 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////// embedding API ///////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// simulator.h. The handle only records which thread it belongs to; the
+// machine itself is that thread's _Thread_local state, so the accessors hand
+// out the live arrays without copying.
+_Static_assert(SIM_NUM_REGISTERS == NUM_REGISTERS, "simulator.h register count");
+_Static_assert(SIM_MEMORY_WORDS == MEMORY_SIZE && SIM_DATA_START == DATA_MEM_START, "simulator.h memory map");
+_Static_assert(SIM_HALT_DRAINED == HALT_DRAINED && SIM_HALT_CYCLE_LIMIT == HALT_CYCLE_LIMIT, "simulator.h halt codes");
+
+struct SimMachine {
+    pthread_t owner; // The thread whose machine state this handle refers to
+};
+
+_Thread_local SimMachine* thread_machine = NULL;
+
+// Every entry point below starts here. A handle used from another thread
+// would quietly act on the calling thread's machine instead, so that aborts.
+void sim_check_owner(const SimMachine* machine, const char* function) {
+    if (machine != NULL && machine == thread_machine && pthread_equal(machine->owner, pthread_self())) return;
+    printf("%s: SimMachine %p is not owned by the calling thread\n", function, (const void*)machine);
+    fflush(stdout);
+    abort();
+}
+
+SimMachine* sim_create(void) {
+    if (thread_machine != NULL) return NULL;
+    SimMachine* machine = malloc(sizeof(SimMachine));
+    if (machine == NULL) return NULL;
+    machine->owner = pthread_self();
+    thread_machine = machine;
+    pipeline_config = (PipelineConfig)DEFAULT_PIPELINE_CONFIG;
+    trace_enabled = false;
+    cycle_limit = INT_MAX;
+    initialize_processor();
+    return machine;
+}
+
+void sim_destroy(SimMachine* machine) {
+    if (machine == NULL) return;
+    sim_check_owner(machine, "sim_destroy");
+    thread_machine = NULL;
+    free(machine);
+}
+
+int sim_load_words(SimMachine* machine, const uint32_t* words, int count) {
+    sim_check_owner(machine, "sim_load_words");
+    if (count < 0 || count > INSTRUCTION_MEM_END + 1) return -1;
+    initialize_processor();
+    memcpy(memory, words, count * sizeof(uint32_t));
+    instructions_loaded_count = count;
+    return count;
+}
+
+int sim_load_assembly(SimMachine* machine, const char* source, size_t length) {
+    sim_check_owner(machine, "sim_load_assembly");
+    jmp_buf on_error;
+    initialize_processor();
+    if (setjmp(on_error) != 0) {
+        assembly_error_handler = NULL;
+        initialize_processor();
+        return -1;
+    }
+    assembly_error_handler = &on_error;
+    int count = assemble_source(source, length);
+    assembly_error_handler = NULL;
+    return count;
+}
+
+bool sim_configure(SimMachine* machine, const char* key, const char* value) {
+    sim_check_owner(machine, "sim_configure");
+    return parse_pipeline_setting(&pipeline_config, key, value);
+}
+
+void sim_set_tracing(SimMachine* machine, bool enabled) {
+    sim_check_owner(machine, "sim_set_tracing");
+    trace_enabled = enabled;
+}
+
+void sim_set_cycle_limit(SimMachine* machine, int max_cycles) {
+    sim_check_owner(machine, "sim_set_cycle_limit");
+    cycle_limit = max_cycles > 0 ? max_cycles : INT_MAX;
+}
+
+long sim_step(SimMachine* machine, long cycles) {
+    long n = 0;
+    sim_check_owner(machine, "sim_step");
+    while (n < cycles && !halt_simulation) {
+        n += skip_idle_cycles(cycles - n - 1);
+        simulate_clock_cycle();
+        n++;
+    }
+    return n;
+}
+
+long sim_run_until(SimMachine* machine, SimStopFn stop, void* user, long max_cycles) {
+    long n = 0;
+    sim_check_owner(machine, "sim_run_until");
+    while (n < max_cycles && !halt_simulation) {
+        if (stop == NULL) n += skip_idle_cycles(max_cycles - n - 1);
+        simulate_clock_cycle();
+        n++;
+        if (stop != NULL && stop(machine, user)) break;
+    }
+    return n;
+}
+
+int32_t* sim_registers(SimMachine* machine) {
+    sim_check_owner(machine, "sim_registers");
+    return registers;
+}
+
+uint32_t* sim_memory(SimMachine* machine) {
+    sim_check_owner(machine, "sim_memory");
+    return memory;
+}
+
+int32_t sim_pc(const SimMachine* machine) {
+    sim_check_owner(machine, "sim_pc");
+    return PC;
+}
+
+int sim_cycle(const SimMachine* machine) {
+    sim_check_owner(machine, "sim_cycle");
+    return current_cycle;
+}
+
+long sim_retired(const SimMachine* machine) {
+    sim_check_owner(machine, "sim_retired");
+    return instructions_retired;
+}
+
+int sim_halt_reason(const SimMachine* machine) {
+    sim_check_owner(machine, "sim_halt_reason");
+    return halt_simulation;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////main///////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// --- Main Simulation Loop ---
+// Left out of the library targets (SIMULATOR_LIBRARY), see simulator.h.
+#ifndef SIMULATOR_LIBRARY
+int main(int argc, char* argv[]) {
+    const char* program_file = NULL;
+    const char* program_files[MAX_CORES];
+    int num_program_files = 0;
+    int cores = 0;
+    const char* lanes_file = NULL;
+    const char* sweep_grid = NULL;
+    const char* sweep_cache = SWEEP_CACHE_FILE;
+    bool replay = false;
+    int max_cycles = 0;
+    int fuzz_cases = 0;
+    uint32_t fuzz_seed = (uint32_t)time(NULL);
+    int fuzz_threads = default_host_threads();
+    bool debug_mode = false;
+    int gdb_port = 0;
+    int dump_format = DUMP_FULL;
+    const char* dump_file = NULL;
+    bool profile = false;
+    bool quiet = false;
+    const char* input_file = NULL;
+    const char* output_file = NULL;
+
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--max-cycles") == 0 && a + 1 < argc) {
+            max_cycles = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--dump") == 0 && a + 1 < argc) {
+            dump_format = parse_dump_format(argv[++a]);
+        } else if (strcmp(argv[a], "--dump-file") == 0 && a + 1 < argc) {
+            dump_file = argv[++a];
+        } else if (strcmp(argv[a], "--pipeline") == 0 && a + 1 < argc) {
+            parse_pipeline_spec(argv[++a], &configured_pipeline);
+        } else if (strcmp(argv[a], "--latency") == 0 && a + 1 < argc) {
+            load_latency_config(argv[++a], &configured_pipeline);
+        } else if (strcmp(argv[a], "--sweep") == 0 && a + 1 < argc) {
+            sweep_grid = argv[++a];
+        } else if (strcmp(argv[a], "--sweep-cache") == 0 && a + 1 < argc) {
+            sweep_cache = argv[++a];
+        } else if (strcmp(argv[a], "--replay") == 0) {
+            replay = true;
+        } else if (strcmp(argv[a], "--lanes") == 0 && a + 1 < argc) {
+            lanes_file = argv[++a];
+        } else if (strcmp(argv[a], "--cores") == 0 && a + 1 < argc) {
+            cores = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--quantum") == 0 && a + 1 < argc) {
+            multicore_quantum = atoi(argv[++a]);
+            if (multicore_quantum < 1) multicore_quantum = 1;
+        } else if (strcmp(argv[a], "--deterministic") == 0) {
+            multicore_deterministic = true;
+        } else if (strcmp(argv[a], "--vlen") == 0 && a + 1 < argc) {
+            int length = atoi(argv[++a]);
+            if (length < 1) length = 1;
+            if (length > MAX_VECTOR_LENGTH) length = MAX_VECTOR_LENGTH;
+            configured_pipeline.vector_length = length;
+        } else if (strcmp(argv[a], "--input") == 0 && a + 1 < argc) {
+            input_file = argv[++a];
+        } else if (strcmp(argv[a], "--output") == 0 && a + 1 < argc) {
+            output_file = argv[++a];
+        } else if (strcmp(argv[a], "--profile") == 0) {
+            profile = true;
+        } else if (strcmp(argv[a], "--quiet") == 0) {
+            quiet = true;
+        } else if (strcmp(argv[a], "--debug") == 0) {
+            debug_mode = true;
+        } else if (strcmp(argv[a], "--gdb") == 0 && a + 1 < argc) {
+            gdb_port = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--fuzz") == 0 && a + 1 < argc) {
+            fuzz_cases = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--seed") == 0 && a + 1 < argc) {
+            fuzz_seed = (uint32_t)strtoul(argv[++a], NULL, 10);
+        } else if (strcmp(argv[a], "--threads") == 0 && a + 1 < argc) {
+            fuzz_threads = atoi(argv[++a]);
+        } else if (argv[a][0] == '-') {
+            printf("Usage: %s [--max-cycles N] [--vlen N] [--profile] [--quiet] [--debug | --gdb <port>]\n", argv[0]);
+            printf("          [--dump full|diff|binary|json] [--dump-file <file>]\n");
+            printf("          [--input <words.bin>] [--output <words.bin>] <program.txt>\n");
+            printf("       %s --cores N [--quantum N] [--deterministic] [--max-cycles N] <program.txt>...\n", argv[0]);
+            printf("       %s --lanes <instances.txt> <program.txt>\n", argv[0]);
+            printf("       %s --sweep <grid.txt> [--replay] [--sweep-cache <file>] [--threads N] <program.txt>...\n", argv[0]);
+            printf("   --pipeline memory_port=shared|split,id_latency=N,ex_latency=N,forwarding=on|off,branch=flush|stall,\n");
+            printf("              mem_latency=N,<OPCODE>=N,<alu|mul|agu|vector>_unit=pipelined|blocking,fusion=on|off,\n");
+            printf("              store_buffer=N,vlen=N\n");
+            printf("   --latency <file>   the same settings, one \"key value\" per line\n");
+            printf("       %s --fuzz <programs> [--seed N] [--threads N]\n", argv[0]);
+            return 1;
+        } else {
+            program_file = argv[a];
+            if (num_program_files < MAX_CORES) program_files[num_program_files++] = argv[a];
+        }
+    }
+
+#ifdef HOST_PROFILE
+    start_host_profile();
+#endif
+    pipeline_config = configured_pipeline;
+    // fuzz, sweep and lanes compare against reference_run, which has no I/O
+    // ports, so a program reading real input would always show as a mismatch.
+    if ((input_file != NULL || output_file != NULL) && (fuzz_cases > 0 || sweep_grid != NULL || lanes_file != NULL)) {
+        printf("--input/--output only apply to a single run, --cores, --debug or --gdb.\n");
+        return 1;
+    }
+    if (input_file != NULL) open_io_stream(&io_input, input_file, "rb");
+    if (output_file != NULL) open_io_stream(&io_output, output_file, "wb");
+    if (input_file != NULL || output_file != NULL) atexit(close_io_streams);
+    if (fuzz_cases > 0) {
+        return run_fuzz_campaign(fuzz_cases, fuzz_seed, fuzz_threads);
+    }
+    if (sweep_grid != NULL) {
+        return run_sweep(sweep_grid, program_files, num_program_files, fuzz_threads, sweep_cache, replay);
+    }
+    if (lanes_file != NULL && program_file != NULL) {
+        return run_lockstep_lanes(program_file, lanes_file);
+    }
+    if (cores > 0) {
+        return run_multicore(cores, program_files, num_program_files, max_cycles);
+    }
+    cycle_limit = max_cycles;
+    if (debug_mode) {
+        return run_debugger(program_file);
+    }
+    if (gdb_port > 0) {
+        return run_gdb_server(program_file, gdb_port);
+    }
+    if (program_file != NULL) {
+        initialize_processor();
+        load_assembly_file(program_file);
+    }
+    snapshot_initial_state();
+    profiling_enabled = profile;
+    printf("\n--- Starting Simulation (Package 1 Logic) ---\n");
+    trace_enabled = !quiet;
+    while (!halt_simulation) {
+        skip_idle_cycles(LONG_MAX);
+        simulate_clock_cycle();
+    }
+    printf("\n--- Simulation Ended after %d cycles ---\n", current_cycle);
+    if (quiet) printf("(%ld idle cycles fast-forwarded)\n", idle_cycles_skipped);
+    if (pipeline_config.fusion) print_fusion_report();
+    if (pipeline_config.store_buffer_depth > 0) print_store_buffer_report();
+    dump_final_state(dump_format, dump_file);
+    if (profile) print_profile_report();
     return 0;
 }
+#endif // SIMULATOR_LIBRARY
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Runs every sample that has a <name>.expected and diffs its final state.
+#
+#   ./check.sh <simulator> [--pipeline <settings>]
+#
+# With --pipeline only the register and memory lines are compared, since
+# the cycle count in .expected is the default configuration's.
+if [ $# -ne 1 ] && [ $# -ne 3 ]; then
+    echo "usage: $0 <simulator> [--pipeline <settings>]"
+    exit 2
+fi
+sim=$1
+shift
+case $sim in
+    /*) ;;
+    *) sim=$(pwd)/$sim ;;
+esac
+cd "$(dirname "$0")" || exit 2
+tmp=$(mktemp -d) || exit 2
+trap 'rm -rf "$tmp"' EXIT
+first=1
+[ $# -eq 2 ] && first=2
+failed=0
+for expected in *.expected; do
+    name=${expected%.expected}
+    if ! "$sim" --quiet --max-cycles 100000 "$@" --dump diff --dump-file "$tmp/state" "$name.txt" > "$tmp/log"; then
+        echo "FAIL $name (simulator exited with an error)"
+        failed=$((failed + 1))
+        continue
+    fi
+    tail -n +$first "$expected" > "$tmp/want"
+    tail -n +$first "$tmp/state" > "$tmp/got"
+    if diff "$tmp/want" "$tmp/got"; then
+        echo "ok   $name"
+    else
+        echo "FAIL $name"
+        failed=$((failed + 1))
+    fi
+done
+if [ $failed -ne 0 ]; then
+    echo "$failed sample(s) failed"
+    exit 1
+fi
@@ -0,0 +1,36 @@
+# Minimal GDB remote protocol client for trying out --gdb without GDB:
+# sets breakpoints on the given instruction addresses and continues until the
+# program exits, printing each stop and the PC.
+#
+#   ../bin/Debug/"CA project" --gdb 5555 p1.txt &
+#   python3 gdb_client.py 5555 3 7
+import socket
+import sys
+
+sock = socket.create_connection(("127.0.0.1", int(sys.argv[1])))
+
+def command(packet):
+    checksum = sum(packet.encode()) & 0xFF
+    sock.sendall(("$%s#%02x" % (packet, checksum)).encode())
+    data = b""
+    while True:
+        chunk = sock.recv(65536)
+        if not chunk:
+            raise SystemExit("connection closed")
+        data += chunk
+        start, end = data.find(b"$"), data.find(b"#")
+        if start >= 0 and end > start and len(data) >= end + 3:
+            break
+    sock.sendall(b"+")
+    return data[start + 1:end].decode()
+
+command("qSupported:swbreak+")
+for pc in sys.argv[2:]:
+    command("Z0,%x,4" % (int(pc) * 4))
+while True:
+    reply = command("c")
+    if reply.startswith("W"):
+        print(reply, "(exited)")
+        break
+    pc = int.from_bytes(bytes.fromhex(command("p20")), "little") // 4
+    print(reply, "pc", pc)
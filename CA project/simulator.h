@@ -0,0 +1,79 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+// Embedding API for the Package 1 pipeline simulator.
+//
+// Build the "Library" (static) or "Shared" target of the project, which
+// compiles main.c with SIMULATOR_LIBRARY so the command-line main() is left
+// out, and link against it.
+//
+// A SimMachine is the machine state of the calling host thread: each thread
+// can own one machine at a time, and every call on it must come from that
+// thread (a call from any other thread, or with a NULL or destroyed handle,
+// prints a message and aborts). Run machines in parallel by creating one per host thread. Reloading
+// a program resets the machine, so a single handle can run any number of
+// short simulations back to back.
+//
+//     SimMachine* m = sim_create();
+//     sim_load_words(m, program, length);
+//     sim_run_until(m, NULL, NULL, 100000);
+//     int32_t result = sim_registers(m)[3];
+//     sim_destroy(m);
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SIM_NUM_REGISTERS 32
+#define SIM_MEMORY_WORDS  2048 // Instructions 0..1023, data 1024..2047
+#define SIM_DATA_START    1024
+
+#define SIM_RUNNING          0
+#define SIM_HALT_DRAINED     1 // PC past the program and pipeline empty
+#define SIM_HALT_CYCLE_LIMIT 2 // sim_set_cycle_limit reached
+
+typedef struct SimMachine SimMachine;
+
+// Returns NULL if the calling thread already owns a machine.
+SimMachine* sim_create(void);
+void        sim_destroy(SimMachine* machine);
+
+// Reset the machine and load a program at address 0. sim_load_words takes
+// encoded instruction words; sim_load_assembly takes assembly source text.
+// Both return the instruction count, or -1 if the program does not fit or
+// does not assemble (the assembler's message is printed).
+int sim_load_words(SimMachine* machine, const uint32_t* words, int count);
+int sim_load_assembly(SimMachine* machine, const char* source, size_t length);
+
+// Pipeline settings, same keys and values as --pipeline (memory_port,
+// id_latency, ex_latency, forwarding, branch, mem_latency, an opcode name
+// such as "MULI" for its EX latency, alu_unit/mul_unit/agu_unit/vector_unit,
+// fusion, store_buffer, vlen for the elements per vector instruction, 1..16).
+// Settings last until sim_destroy; sim_load_* keeps them. Returns false if
+// rejected.
+bool sim_configure(SimMachine* machine, const char* key, const char* value);
+void sim_set_tracing(SimMachine* machine, bool enabled);     // Per-cycle stage log on stdout (off by default)
+void sim_set_cycle_limit(SimMachine* machine, int max_cycles); // 0 = no limit (default)
+
+// Advance up to `cycles` clock cycles, stopping early on halt. Returns the
+// number of cycles simulated.
+long sim_step(SimMachine* machine, long cycles);
+
+// Run until the machine halts, `stop` returns true (checked after every
+// cycle, may be NULL) or `max_cycles` cycles have been simulated. Returns the
+// number of cycles simulated.
+typedef bool (*SimStopFn)(SimMachine* machine, void* user);
+long sim_run_until(SimMachine* machine, SimStopFn stop, void* user, long max_cycles);
+
+// Live views of the machine state, valid until sim_destroy. Writes through
+// them change the running machine. With store_buffer set, stores still in the
+// buffer reach memory when it drains (at the latest when the machine halts).
+int32_t*  sim_registers(SimMachine* machine); // SIM_NUM_REGISTERS entries
+uint32_t* sim_memory(SimMachine* machine);    // SIM_MEMORY_WORDS entries
+
+int32_t sim_pc(const SimMachine* machine);
+int     sim_cycle(const SimMachine* machine);
+long    sim_retired(const SimMachine* machine);
+int     sim_halt_reason(const SimMachine* machine); // SIM_RUNNING or SIM_HALT_*
+
+#endif // SIMULATOR_H